@@ -0,0 +1,40 @@
+#!/bin/sh
+# Renders a scene locally and through a coordinator with one and with three
+# workers on a local socket, then checks that the assembled frames match:
+# tile splits must equal the local render bit for bit, and sample splits
+# must not depend on the number of workers.
+#
+# usage: examples/farm_check.sh path/to/tpm [scene.xml]
+set -eu
+
+tpm=${1:?usage: farm_check.sh path/to/tpm [scene.xml]}
+scene=${2:-$(dirname "$0")/scene0.xml}
+seed=1234
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+farm() {
+  socket="$dir/$1-$2.sock"
+  "$tpm" --coordinate "$socket" --split "$1" --seed "$seed" \
+    -o "$dir/$1-$2.raw" "$scene" &
+  coordinator=$!
+  i=0
+  while [ "$i" -lt "$2" ]; do
+    "$tpm" --work "$socket" &
+    i=$((i + 1))
+  done
+  wait "$coordinator"
+  # Workers exit once the coordinator closes their connections.
+  wait
+}
+
+"$tpm" --seed "$seed" -o "$dir/local.raw" "$scene"
+farm tiles 1
+farm tiles 3
+farm samples 1
+farm samples 3
+
+cmp "$dir/local.raw" "$dir/tiles-1.raw"
+cmp "$dir/local.raw" "$dir/tiles-3.raw"
+cmp "$dir/samples-1.raw" "$dir/samples-3.raw"
+echo "Distributed frames match"
@@ -0,0 +1,151 @@
+#include "checkpoint.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "log.hpp"
+#include "prof.hpp"
+
+template <typename T> static void put(std::ofstream &file, const T &v) {
+  file.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+template <typename T> static bool get(std::ifstream &file, T &v) {
+  return static_cast<bool>(
+      file.read(reinterpret_cast<char *>(&v), sizeof(T)));
+}
+
+// The file is a header of u32 fields (magic, version, width, height, tile,
+// frame, passes, output count), one u32 per output variable, the tile seeds
+// as four u32 each, then the accumulated outputs as packed rgb f32.
+bool tpm::checkpoint::write(const std::filesystem::path &path,
+                            const State &state) {
+  PFUNC(path.string(), state.passes);
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary);
+    for (std::uint32_t v :
+         {magic, version, state.size[0], state.size[1], state.size[2],
+          state.frame, state.passes,
+          static_cast<std::uint32_t>(state.aovs.size())})
+      put(file, v);
+    for (const AovType &aov : state.aovs)
+      put(file, static_cast<std::uint32_t>(aov));
+    put(file, static_cast<std::uint32_t>(state.seeds.size()));
+    for (const cl::sycl::uint4 &seed : state.seeds) {
+      for (int c = 0; c < 4; ++c)
+        put(file, static_cast<std::uint32_t>(seed[c]));
+    }
+    std::vector<float> packed(3 * state.accum.size());
+    for (std::size_t i = 0; i < state.accum.size(); ++i) {
+      for (int c = 0; c < 3; ++c)
+        packed[3 * i + c] = state.accum[i][c];
+    }
+    file.write(reinterpret_cast<const char *>(packed.data()),
+               static_cast<std::streamsize>(packed.size() * sizeof(float)));
+    if (!file)
+      return false;
+  }
+  // Renaming over the previous checkpoint keeps it intact if this write is
+  // interrupted.
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  return !ec;
+}
+
+// Every count in the header is checked against the format's limits and the
+// bytes left in the file before anything is allocated from it, so a
+// truncated or foreign file is rejected instead of crashing the reader.
+std::shared_ptr<tpm::checkpoint::State>
+tpm::checkpoint::read(const std::filesystem::path &path) {
+  PFUNC(path.string());
+  std::error_code ec;
+  std::uint64_t remaining = std::filesystem::file_size(path, ec);
+  if (ec)
+    return nullptr;
+  std::ifstream file(path, std::ios::binary);
+  std::uint32_t head[8];
+  if (remaining < sizeof(head))
+    return nullptr;
+  remaining -= sizeof(head);
+  for (std::uint32_t &v : head) {
+    if (!get(file, v))
+      return nullptr;
+  }
+  if (head[0] != magic || head[1] != version || head[7] > max_outputs ||
+      remaining < (head[7] + 1) * sizeof(std::uint32_t))
+    return nullptr;
+  remaining -= (head[7] + 1) * sizeof(std::uint32_t);
+
+  std::shared_ptr<State> state = std::make_shared<State>();
+  state->size = cl::sycl::uint3(head[2], head[3], head[4]);
+  state->frame = head[5];
+  state->passes = head[6];
+  for (std::uint32_t i = 0, aov = 0; i < head[7]; ++i) {
+    if (!get(file, aov) || aov > static_cast<std::uint32_t>(STEPS))
+      return nullptr;
+    state->aovs.push_back(static_cast<AovType>(aov));
+  }
+  std::uint32_t seed_count = 0;
+  std::uint64_t seed_bytes = 4 * sizeof(std::uint32_t);
+  if (!get(file, seed_count) || seed_count > remaining / seed_bytes)
+    return nullptr;
+  remaining -= seed_count * seed_bytes;
+  for (std::uint32_t i = 0; i < seed_count; ++i) {
+    std::uint32_t seed[4];
+    for (std::uint32_t &v : seed) {
+      if (!get(file, v))
+        return nullptr;
+    }
+    state->seeds.emplace_back(seed[0], seed[1], seed[2], seed[3]);
+  }
+
+  std::uint64_t pixels = static_cast<std::uint64_t>(head[2]) * head[3];
+  std::uint64_t pixel_bytes = 3 * sizeof(float) * head[7];
+  if (pixel_bytes == 0 ? remaining != 0
+                       : remaining % pixel_bytes != 0 ||
+                             remaining / pixel_bytes != pixels)
+    return nullptr;
+  std::size_t count = static_cast<std::size_t>(pixels * head[7]);
+  std::vector<float> packed(3 * count);
+  if (!file.read(reinterpret_cast<char *>(packed.data()),
+                 static_cast<std::streamsize>(packed.size() * sizeof(float))))
+    return nullptr;
+  state->accum.reserve(count);
+  for (std::size_t i = 0; i < count; ++i)
+    state->accum.emplace_back(packed[3 * i], packed[3 * i + 1],
+                              packed[3 * i + 2]);
+  return state;
+}
+
+tpm::checkpoint::Writer::~Writer() {
+  if (thread.joinable())
+    thread.join();
+}
+
+bool tpm::checkpoint::Writer::busy() const { return writing.load(); }
+
+void tpm::checkpoint::Writer::offer(const std::filesystem::path &path,
+                                    std::shared_ptr<const State> state) {
+  if (thread.joinable())
+    thread.join();
+  writing = true;
+  thread = std::thread([this, path, state = std::move(state)]() {
+    if (write(path, *state))
+      LINFO("Checkpointed frame {} after {} passes to \"{}\"", state->frame,
+            state->passes, path.string());
+    else
+      LWARN("Failed to write checkpoint \"{}\"", path.string());
+    writing = false;
+  });
+}
@@ -0,0 +1,47 @@
+#ifndef CHECKPOINT_HPP_Q2WM6JXT
+#define CHECKPOINT_HPP_Q2WM6JXT
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "scene.hpp"
+
+namespace tpm::checkpoint {
+
+constexpr std::uint32_t magic = 0x4b435054;
+constexpr std::uint32_t version = 1;
+
+struct State {
+  cl::sycl::uint3 size;
+  std::uint32_t frame, passes;
+  std::vector<AovType> aovs;
+  std::vector<cl::sycl::uint4> seeds;
+  std::vector<cl::sycl::float3> accum;
+};
+
+bool write(const std::filesystem::path &path, const State &state);
+std::shared_ptr<State> read(const std::filesystem::path &path);
+
+struct Writer {
+  Writer() = default;
+  Writer(const Writer &) = delete;
+  Writer &operator=(const Writer &) = delete;
+  ~Writer();
+
+  bool busy() const;
+  void offer(const std::filesystem::path &path,
+             std::shared_ptr<const State> state);
+
+  std::thread thread;
+  std::atomic<bool> writing{false};
+};
+
+} // namespace tpm::checkpoint
+
+#endif /* end of include guard: CHECKPOINT_HPP_Q2WM6JXT */
@@ -0,0 +1,72 @@
+#include "convert.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "prof.hpp"
+
+constexpr std::size_t lut_size = 4096;
+
+std::vector<float> tpm::srgb_lut(const bool &srgb) {
+  std::vector<float> lut(lut_size);
+  for (std::size_t i = 0; i < lut_size; ++i) {
+    float v = static_cast<float>(i) / static_cast<float>(lut_size - 1);
+    lut[i] = 255.0f * (srgb ? srgb_encode(v) : v);
+  }
+  return lut;
+}
+
+std::vector<std::uint8_t>
+tpm::to_rgb8(cl::sycl::queue &queue, const PixelView &data,
+             const std::uint32_t &width, const std::uint32_t &y0,
+             const std::uint32_t &y1, const bool &srgb, const bool &dither) {
+  PFUNC(width, y0, y1, srgb, dither);
+  std::vector<float> lut = srgb_lut(srgb);
+  std::size_t count = static_cast<std::size_t>(width) * (y1 - y0);
+  std::vector<std::uint8_t> rgb(count * 3);
+  {
+    PixelFormat format = data.format;
+    cl::sycl::buffer<std::uint32_t> img_buffer(data.data,
+                                               count * pixel_words(format));
+    cl::sycl::buffer<float> lut_buffer(lut.data(), lut.size());
+    cl::sycl::buffer<std::uint8_t> rgb_buffer(rgb.data(), rgb.size());
+
+    queue.submit([&](cl::sycl::handler &cgh) {
+      cl::sycl::accessor<std::uint32_t, 1, cl::sycl::access::mode::read>
+          img_ptr = img_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+      cl::sycl::accessor<float, 1, cl::sycl::access::mode::read> lut_ptr =
+          lut_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+      cl::sycl::accessor<std::uint8_t, 1,
+                         cl::sycl::access::mode::discard_write>
+          rgb_ptr =
+              rgb_buffer.get_access<cl::sycl::access::mode::discard_write>(
+                  cgh);
+
+      cgh.parallel_for(
+          cl::sycl::range<1>(y1 - y0), [=](cl::sycl::item<1> item) {
+            std::uint32_t y = static_cast<std::uint32_t>(item[0]);
+            for (std::uint32_t x = 0; x < width; ++x) {
+              std::size_t idx = static_cast<std::size_t>(y) * width + x;
+              float noise = dither ? dither_noise(x, y0 + y) : 0.0f;
+              cl::sycl::float3 pixel = load_pixel(format, img_ptr, idx);
+              for (int c = 0; c < 3; ++c) {
+                float v = cl::sycl::clamp(pixel[c], 0.0f, 1.0f);
+                float s = lut_ptr[static_cast<std::size_t>(
+                    v * static_cast<float>(lut_size - 1) + 0.5f)];
+                rgb_ptr[3 * idx + c] = static_cast<std::uint8_t>(
+                    cl::sycl::clamp(s + noise + 0.5f, 0.0f, 255.0f));
+              }
+            }
+          });
+    });
+  }
+  return rgb;
+}
+
+std::vector<std::uint8_t> tpm::to_rgb8(cl::sycl::queue &queue,
+                                       const Image &img, const bool &srgb,
+                                       const bool &dither) {
+  return to_rgb8(queue, img.view(), img.size[0], 0, img.size[1], srgb, dither);
+}
@@ -0,0 +1,36 @@
+#ifndef CONVERT_HPP_B5LS8EPQ
+#define CONVERT_HPP_B5LS8EPQ
+
+#include <cstdint>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "render.hpp"
+
+namespace tpm {
+
+inline float srgb_encode(const float &v) {
+  return v <= 0.0031308f ? 12.92f * v
+                         : 1.055f * cl::sycl::pow(v, 1.0f / 2.4f) - 0.055f;
+}
+inline float dither_noise(const std::uint32_t &x, const std::uint32_t &y) {
+  float n = 0.06711056f * static_cast<float>(x) +
+            0.00583715f * static_cast<float>(y);
+  n = 52.9829189f * (n - cl::sycl::floor(n));
+  return n - cl::sycl::floor(n) - 0.5f;
+}
+
+std::vector<float> srgb_lut(const bool &srgb);
+std::vector<std::uint8_t> to_rgb8(cl::sycl::queue &queue,
+                                  const PixelView &data,
+                                  const std::uint32_t &width,
+                                  const std::uint32_t &y0,
+                                  const std::uint32_t &y1, const bool &srgb,
+                                  const bool &dither);
+std::vector<std::uint8_t> to_rgb8(cl::sycl::queue &queue, const Image &img,
+                                  const bool &srgb, const bool &dither);
+
+} // namespace tpm
+
+#endif /* end of include guard: CONVERT_HPP_B5LS8EPQ */
@@ -0,0 +1,400 @@
+#include "device.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <CL/sycl.hpp>
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "exit_code.hpp"
+#include "log.hpp"
+#include "pool.hpp"
+#include "prof.hpp"
+#include "render.hpp"
+#include "scene.hpp"
+
+constexpr std::chrono::duration<double> target_batch(0.05);
+
+static std::string lower(std::string str) {
+  std::transform(str.begin(), str.end(), str.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return str;
+}
+
+static bool is_number(const std::string &str) {
+  return !str.empty() &&
+         std::all_of(str.begin(), str.end(),
+                     [](unsigned char c) { return std::isdigit(c) != 0; });
+}
+
+static std::string device_type(const cl::sycl::device &device) {
+  if (device.is_host())
+    return "host";
+  if (device.is_cpu())
+    return "cpu";
+  if (device.is_gpu())
+    return "gpu";
+  if (device.is_accelerator())
+    return "accelerator";
+  return "unknown";
+}
+
+static bool matches(const std::string &term, const std::size_t &index,
+                    const cl::sycl::device &device) {
+  if (term == "all" || term == device_type(device) ||
+      (term == "cpu" && device.is_cpu()))
+    return true;
+  if (is_number(term))
+    return std::stoul(term) == index;
+  return lower(device.get_info<cl::sycl::info::device::name>()).find(term) !=
+             std::string::npos ||
+         lower(device.get_platform().get_info<cl::sycl::info::platform::name>())
+                 .find(term) != std::string::npos;
+}
+
+// Parses a sysfs cpu list such as "0-15,32-47".
+static std::vector<int> parse_cpus(const std::string &list) {
+  std::vector<int> cpus;
+  std::istringstream ranges(list);
+  for (std::string range; std::getline(ranges, range, ',');) {
+    std::size_t dash = range.find('-');
+    try {
+      int lo = std::stoi(range.substr(0, dash));
+      int hi = dash == std::string::npos ? lo
+                                         : std::stoi(range.substr(dash + 1));
+      for (int cpu = lo; cpu <= hi; ++cpu)
+        cpus.push_back(cpu);
+    } catch (const std::exception &) {
+      continue;
+    }
+  }
+  return cpus;
+}
+
+void tpm::device::pin(const std::vector<int> &cpus) {
+#if defined(__linux__)
+  if (cpus.empty())
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus)
+    CPU_SET(cpu, &set);
+  if (::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) != 0)
+    LWARN("Failed to pin render thread to cpus {}", fmt::join(cpus, ","));
+#else
+  (void)cpus;
+#endif
+}
+
+std::vector<std::vector<int>> tpm::device::numa_nodes() {
+  std::vector<std::vector<int>> nodes;
+  std::error_code ec;
+  std::filesystem::path root("/sys/devices/system/node");
+  for (std::size_t node = 0;; ++node) {
+    std::filesystem::path cpulist =
+        root / fmt::format("node{}", node) / "cpulist";
+    if (!std::filesystem::exists(cpulist, ec))
+      break;
+    std::ifstream file(cpulist);
+    std::string list;
+    std::getline(file, list);
+    std::vector<int> cpus = parse_cpus(list);
+    if (!cpus.empty())
+      nodes.push_back(cpus);
+  }
+  return nodes;
+}
+
+std::vector<cl::sycl::device> tpm::device::all() {
+  std::vector<cl::sycl::device> devices;
+  for (const cl::sycl::platform &platform :
+       cl::sycl::platform::get_platforms()) {
+    for (const cl::sycl::device &device : platform.get_devices())
+      devices.push_back(device);
+  }
+  return devices;
+}
+
+// The selector is a comma separated list of terms, each "default", "all",
+// a device type (cpu, gpu, host, accelerator), an index from --list-devices
+// or part of a device or platform (backend) name. A ":N" suffix on a host
+// or cpu term splits each matching device into N core-capped slices, and
+// ":numa" into one slice pinned to each NUMA node.
+std::vector<tpm::device::Slice>
+tpm::device::select(const std::string &selector) {
+  PFUNC(selector);
+  std::vector<Slice> slices;
+  if (selector.empty() || selector == "default") {
+    slices.push_back(
+        Slice{cl::sycl::device(cl::sycl::default_selector()), 0, {}});
+    return slices;
+  }
+
+  std::vector<cl::sycl::device> devices = all();
+  std::uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+  std::istringstream terms(selector);
+  for (std::string term; std::getline(terms, term, ',');) {
+    std::uint32_t parts = 1;
+    bool numa = false;
+    std::size_t colon = term.rfind(':');
+    if (colon != std::string::npos && is_number(term.substr(colon + 1))) {
+      parts = std::max(1u, static_cast<std::uint32_t>(
+                               std::stoul(term.substr(colon + 1))));
+      term = term.substr(0, colon);
+    } else if (colon != std::string::npos &&
+               lower(term.substr(colon + 1)) == "numa") {
+      numa = true;
+      term = term.substr(0, colon);
+    }
+    term = lower(term);
+
+    bool found = false;
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+      if (!matches(term, i, devices[i]))
+        continue;
+      found = true;
+      bool host = devices[i].is_host() || devices[i].is_cpu();
+      if (numa && host) {
+        std::vector<std::vector<int>> nodes = numa_nodes();
+        if (nodes.size() > 1) {
+          for (const std::vector<int> &cpus : nodes)
+            slices.push_back(Slice{
+                devices[i], static_cast<std::uint32_t>(cpus.size()), cpus});
+          continue;
+        }
+        LWARN("Found {} NUMA nodes, using device {} whole", nodes.size(), i);
+      }
+      std::uint32_t count = parts;
+      if ((count > 1 || numa) && !host) {
+        LWARN("Only host and cpu devices can be split into slices, using "
+              "device {} whole",
+              i);
+        count = 1;
+      }
+      for (std::uint32_t part = 0; part < count; ++part)
+        slices.push_back(
+            Slice{devices[i], count > 1 ? std::max(1u, cores / count) : 0, {}});
+    }
+    if (!found)
+      LWARN("No device matches \"{}\"", term);
+  }
+  return slices;
+}
+
+// Single-queue renderers run on the first slice a selector matches.
+tpm::ExitCode tpm::device::select_one(const std::string &selector,
+                                      Slice &slice) {
+  std::vector<Slice> slices = select(selector);
+  if (slices.empty()) {
+    LERR("No SYCL device matches \"{}\"", selector);
+    return DEVICE_ERROR;
+  }
+  if (slices.size() > 1)
+    LWARN("Selector \"{}\" matches {} devices, rendering on the first",
+          selector, slices.size());
+  slice = slices.front();
+  LINFO("Rendering on {}",
+        slice.device.get_info<cl::sycl::info::device::name>());
+  return OK;
+}
+
+void tpm::device::list() {
+  std::vector<cl::sycl::device> devices = all();
+  for (std::size_t i = 0; i < devices.size(); ++i) {
+    const cl::sycl::device &device = devices[i];
+    std::cout << fmt::format(
+                     "{:>3}  {:<12} {} [{}] ({} compute units)", i,
+                     device_type(device),
+                     device.get_info<cl::sycl::info::device::name>(),
+                     device.get_platform()
+                         .get_info<cl::sycl::info::platform::name>(),
+                     device.get_info<
+                         cl::sycl::info::device::max_compute_units>())
+              << std::endl;
+  }
+}
+
+namespace tpm::device {
+
+struct Lane {
+  std::unique_ptr<Renderer> renderer;
+  std::string name;
+  std::vector<int> cpus;
+  std::size_t weight = 1;
+  std::vector<cl::sycl::float3> out;
+  double rate = 0.0;
+  std::size_t tiles = 0;
+};
+
+} // namespace tpm::device
+
+tpm::ExitCode tpm::device::render_split(const TpmSpec &spec,
+                                        const std::vector<Slice> &slices,
+                                        WritePool &pool) {
+  PFUNC(slices.size());
+  // Each lane builds its Renderer on a host thread pinned to its slice's
+  // cpus, so a NUMA lane's scene mirrors, tile seeds and tile framebuffer
+  // are first touched on its node and form that node's replica. NUMA lanes
+  // then render on host threads pinned to the node instead of through the
+  // SYCL runtime, whose worker threads and buffers follow no pinning.
+  std::vector<Lane> lanes(slices.size());
+  {
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < slices.size(); ++i) {
+      threads.emplace_back([&, i]() {
+        const Slice &slice = slices[i];
+        pin(slice.cpus);
+        TpmSpec lane_spec = spec;
+        if (slice.cores != 0)
+          lane_spec.renderer.cores = slice.cores;
+        Lane &lane = lanes[i];
+        lane.renderer = std::make_unique<Renderer>(
+            lane_spec, cl::sycl::queue(slice.device));
+        lane.name = slice.device.get_info<cl::sycl::info::device::name>();
+        if (!slice.cpus.empty())
+          lane.name += fmt::format(" (cpus {})", fmt::join(slice.cpus, ","));
+        lane.cpus = slice.cpus;
+        lane.weight = std::max<std::size_t>(
+            1, slice.cores != 0
+                   ? slice.cores
+                   : slice.device.get_info<
+                         cl::sycl::info::device::max_compute_units>());
+      });
+    }
+    for (std::thread &thread : threads)
+      thread.join();
+  }
+
+  Renderer &primary = *lanes.front().renderer;
+  cl::sycl::uint3 img_size = primary.img_size;
+  cl::sycl::uint2 tile_size = primary.tile_size;
+  std::size_t tile_count =
+      static_cast<std::size_t>(tile_size[0]) * tile_size[1];
+  std::size_t output_count = std::min(spec.image.outputs.size(), max_outputs);
+  std::size_t area = static_cast<std::size_t>(img_size[2]) * img_size[2];
+  std::size_t pixels = static_cast<std::size_t>(img_size[0]) * img_size[1];
+  std::vector<cl::sycl::float3> accum;
+
+  // Every lane owns a contiguous home range of tiles in proportion to its
+  // cores or compute units and renders it first, then steals from the lane
+  // with the most tiles left.
+  std::size_t total_weight = 0;
+  for (const Lane &lane : lanes)
+    total_weight += lane.weight;
+  std::vector<std::size_t> begins, ends;
+  for (std::size_t i = 0, weight = 0; i < lanes.size(); ++i) {
+    begins.push_back(tile_count * weight / total_weight);
+    weight += lanes[i].weight;
+    ends.push_back(tile_count * weight / total_weight);
+  }
+  std::vector<std::atomic<std::size_t>> cursors(lanes.size());
+
+  ExitCode status = OK;
+  for (std::uint32_t frame = spec.sequence.start;
+       status == OK && frame <= spec.sequence.end; ++frame) {
+    LINFO("Rendering frame {} of {}-{} on {} devices", frame,
+          spec.sequence.start, spec.sequence.end, lanes.size());
+    accum.assign(pixels * output_count, cl::sycl::float3(0.0f));
+    for (std::size_t i = 0; i < lanes.size(); ++i)
+      cursors[i].store(begins[i]);
+
+    // Batches are sized to the lane's measured throughput, so each takes
+    // about target_batch, and shrink as a range drains so a slow device
+    // does not hold up the tail.
+    auto run = [&](const std::size_t &index) {
+      Lane &lane = lanes[index];
+      pin(lane.cpus);
+      std::vector<std::uint32_t> tiles;
+      lane.tiles = 0;
+      std::size_t owner = index;
+      while (true) {
+        std::size_t left = ends[owner] - std::min(ends[owner],
+                                                  cursors[owner].load());
+        if (left == 0) {
+          owner = lanes.size();
+          for (std::size_t i = 0, most = 0; i < lanes.size(); ++i) {
+            std::size_t rest = ends[i] - std::min(ends[i], cursors[i].load());
+            if (rest > most) {
+              most = rest;
+              owner = i;
+            }
+          }
+          if (owner == lanes.size())
+            break;
+          continue;
+        }
+        std::size_t batch =
+            lane.rate > 0.0
+                ? static_cast<std::size_t>(lane.rate * target_batch.count())
+                : lane.weight;
+        batch = std::clamp<std::size_t>(
+            batch, 1,
+            std::max<std::size_t>(1, owner == index ? left / 2
+                                                    : left / lanes.size()));
+        std::size_t first = cursors[owner].fetch_add(batch);
+        if (first >= ends[owner])
+          continue;
+        tiles.clear();
+        for (std::size_t t = first; t < std::min(first + batch, ends[owner]);
+             ++t)
+          tiles.push_back(static_cast<std::uint32_t>(t));
+
+        std::chrono::steady_clock::time_point begin =
+            std::chrono::steady_clock::now();
+        lane.renderer->render_tiles(frame, tiles, lane.out, lane.cpus);
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - begin;
+        double rate = static_cast<double>(tiles.size()) /
+                      std::max(elapsed.count(), 1e-6);
+        lane.rate = lane.rate > 0.0 ? 0.5 * (lane.rate + rate) : rate;
+        lane.tiles += tiles.size();
+
+        const std::vector<cl::sycl::float3> &out = lane.out;
+        for (std::size_t k = 0; k < tiles.size(); ++k) {
+          cl::sycl::uint4 tile = Image::tile(
+              img_size, cl::sycl::uint2(tiles[k] / tile_size[1],
+                                        tiles[k] % tile_size[1]));
+          for (std::size_t i = 0; i < output_count; ++i) {
+            for (std::uint32_t y = tile[1]; y < tile[3]; ++y) {
+              for (std::uint32_t x = tile[0]; x < tile[2]; ++x)
+                accum[i * pixels +
+                      Image::idx(img_size, cl::sycl::uint2(x, y))] =
+                    out[(k * output_count + i) * area +
+                        (y - tile[1]) * img_size[2] + (x - tile[0])];
+            }
+          }
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < lanes.size(); ++i)
+      threads.emplace_back(run, i);
+    for (std::thread &thread : threads)
+      thread.join();
+
+    for (const Lane &lane : lanes)
+      LINFO("{} rendered {} tiles at {:.1f} tiles/s", lane.name, lane.tiles,
+            lane.rate);
+    status = primary.render(frame, pool, &accum);
+  }
+  return status;
+}
@@ -0,0 +1,36 @@
+#ifndef DEVICE_HPP_R8XK2NVA
+#define DEVICE_HPP_R8XK2NVA
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "exit_code.hpp"
+#include "pool.hpp"
+#include "scene.hpp"
+
+namespace tpm::device {
+
+// A device, or a core-capped share of a host device, that renders as one
+// lane of a multi-device frame. NUMA slices also list the node's cpus,
+// which the lane's host threads are pinned to and render on.
+struct Slice {
+  cl::sycl::device device;
+  std::uint32_t cores = 0;
+  std::vector<int> cpus;
+};
+
+std::vector<cl::sycl::device> all();
+std::vector<std::vector<int>> numa_nodes();
+void pin(const std::vector<int> &cpus);
+std::vector<Slice> select(const std::string &selector);
+ExitCode select_one(const std::string &selector, Slice &slice);
+void list();
+ExitCode render_split(const TpmSpec &spec, const std::vector<Slice> &slices,
+                      WritePool &pool);
+
+} // namespace tpm::device
+
+#endif /* end of include guard: DEVICE_HPP_R8XK2NVA */
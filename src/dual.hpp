@@ -0,0 +1,113 @@
+#ifndef DUAL_HPP_Q8WMZ2TF
+#define DUAL_HPP_Q8WMZ2TF
+
+#include <CL/sycl.hpp>
+
+namespace tpm {
+
+struct Dual {
+  Dual() : val(0.0f), grad(0.0f, 0.0f, 0.0f) {}
+  Dual(const float &val) : val(val), grad(0.0f, 0.0f, 0.0f) {}
+  Dual(const float &val, const cl::sycl::float3 &grad)
+      : val(val), grad(grad) {}
+
+  float val;
+  cl::sycl::float3 grad;
+};
+
+inline Dual operator-(const Dual &a) { return Dual(-a.val, -a.grad); }
+inline Dual operator+(const Dual &a, const Dual &b) {
+  return Dual(a.val + b.val, a.grad + b.grad);
+}
+inline Dual operator-(const Dual &a, const Dual &b) {
+  return Dual(a.val - b.val, a.grad - b.grad);
+}
+inline Dual operator*(const Dual &a, const Dual &b) {
+  return Dual(a.val * b.val, (a.grad * b.val) + (b.grad * a.val));
+}
+inline Dual operator/(const Dual &a, const Dual &b) {
+  return Dual(a.val / b.val,
+              ((a.grad * b.val) - (b.grad * a.val)) / (b.val * b.val));
+}
+inline bool operator<(const Dual &a, const Dual &b) { return a.val < b.val; }
+inline bool operator>(const Dual &a, const Dual &b) { return a.val > b.val; }
+
+inline Dual sqrt(const Dual &a) {
+  float s = cl::sycl::sqrt(a.val);
+  return Dual(s, s > 0.0f ? a.grad / (2.0f * s)
+                          : cl::sycl::float3(0.0f, 0.0f, 0.0f));
+}
+inline Dual fabs(const Dual &a) { return a.val < 0.0f ? -a : a; }
+inline Dual sign(const Dual &a) { return Dual(cl::sycl::sign(a.val)); }
+inline Dual min(const Dual &a, const Dual &b) { return b < a ? b : a; }
+inline Dual max(const Dual &a, const Dual &b) { return a < b ? b : a; }
+inline Dual clamp(const Dual &a, const Dual &lo, const Dual &hi) {
+  return min(max(a, lo), hi);
+}
+inline Dual sin(const Dual &a) {
+  return Dual(cl::sycl::sin(a.val), a.grad * cl::sycl::cos(a.val));
+}
+inline Dual cos(const Dual &a) {
+  return Dual(cl::sycl::cos(a.val), a.grad * -cl::sycl::sin(a.val));
+}
+
+struct Dual3 {
+  Dual3() : v{Dual(), Dual(), Dual()} {}
+  Dual3(const Dual &x, const Dual &y, const Dual &z) : v{x, y, z} {}
+
+  inline Dual &operator[](const int &i) { return v[i]; }
+  inline const Dual &operator[](const int &i) const { return v[i]; }
+
+  Dual v[3];
+};
+
+inline Dual3 dual_variable(const cl::sycl::float3 &p) {
+  return Dual3(Dual(p[0], cl::sycl::float3(1.0f, 0.0f, 0.0f)),
+               Dual(p[1], cl::sycl::float3(0.0f, 1.0f, 0.0f)),
+               Dual(p[2], cl::sycl::float3(0.0f, 0.0f, 1.0f)));
+}
+
+inline Dual3 operator-(const Dual3 &a) { return Dual3(-a[0], -a[1], -a[2]); }
+inline Dual3 operator+(const Dual3 &a, const Dual3 &b) {
+  return Dual3(a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+}
+inline Dual3 operator-(const Dual3 &a, const Dual3 &b) {
+  return Dual3(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+}
+inline Dual3 operator+(const Dual3 &a, const cl::sycl::float3 &b) {
+  return Dual3(a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+}
+inline Dual3 operator-(const Dual3 &a, const cl::sycl::float3 &b) {
+  return Dual3(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+}
+inline Dual3 operator*(const Dual3 &a, const cl::sycl::float3 &b) {
+  return Dual3(a[0] * b[0], a[1] * b[1], a[2] * b[2]);
+}
+inline Dual3 operator/(const Dual3 &a, const cl::sycl::float3 &b) {
+  return Dual3(a[0] / b[0], a[1] / b[1], a[2] / b[2]);
+}
+inline Dual3 operator*(const Dual3 &a, const Dual &b) {
+  return Dual3(a[0] * b, a[1] * b, a[2] * b);
+}
+inline Dual3 operator*(const Dual &a, const Dual3 &b) { return b * a; }
+inline Dual3 operator/(const Dual3 &a, const Dual &b) {
+  return Dual3(a[0] / b, a[1] / b, a[2] / b);
+}
+
+inline Dual3 fabs(const Dual3 &a) {
+  return Dual3(fabs(a[0]), fabs(a[1]), fabs(a[2]));
+}
+inline Dual3 min(const Dual3 &a, const Dual &b) {
+  return Dual3(min(a[0], b), min(a[1], b), min(a[2], b));
+}
+inline Dual3 max(const Dual3 &a, const Dual &b) {
+  return Dual3(max(a[0], b), max(a[1], b), max(a[2], b));
+}
+inline Dual dot(const Dual3 &a, const Dual3 &b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+inline Dual length(const Dual3 &a) { return sqrt(dot(a, a)); }
+
+} // namespace tpm
+
+#endif /* end of include guard: DUAL_HPP_Q8WMZ2TF */
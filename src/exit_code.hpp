@@ -16,7 +16,12 @@ namespace tpm
 
 
     MKDIR_ERROR,
-    IMG_WRITE_ERR
+    IMG_WRITE_ERR,
+
+    SOCKET_ERROR,
+    CHECKPOINT_ERROR,
+    ARGPARSE_INVALID_VALUE,
+    DEVICE_ERROR
 };
 } /* tpm */ 
 
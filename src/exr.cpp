@@ -0,0 +1,213 @@
+#include "exr.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "half.hpp"
+#include "log.hpp"
+#include "parallel.hpp"
+#include "prof.hpp"
+
+constexpr std::uint8_t half_type = 1;
+constexpr std::uint8_t zip_compression = 3;
+constexpr std::uint8_t random_y = 2;
+
+template <typename T>
+static void put(std::vector<std::uint8_t> &out, const T &v) {
+  std::uint8_t bytes[sizeof(T)];
+  std::memcpy(bytes, &v, sizeof(T));
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void put_attr(std::vector<std::uint8_t> &out, const std::string &name,
+                     const std::string &type,
+                     const std::vector<std::uint8_t> &value) {
+  out.insert(out.end(), name.begin(), name.end());
+  out.push_back(0);
+  out.insert(out.end(), type.begin(), type.end());
+  out.push_back(0);
+  put(out, static_cast<std::int32_t>(value.size()));
+  out.insert(out.end(), value.begin(), value.end());
+}
+
+std::vector<std::uint8_t> tpm::exr::encode_tile(const PixelView &data,
+                                                const std::uint32_t &stride,
+                                                const std::uint32_t &width,
+                                                const std::uint32_t &height,
+                                                const int &level) {
+  std::vector<std::uint8_t> raw;
+  raw.reserve(static_cast<std::size_t>(width) * height * 6);
+  std::vector<cl::sycl::float3> row(width);
+  for (std::uint32_t y = 0; y < height; ++y) {
+    for (std::uint32_t x = 0; x < width; ++x)
+      row[x] = data[y * stride + x];
+    for (int c = 2; c >= 0; --c) {
+      for (std::uint32_t x = 0; x < width; ++x)
+        put(raw, float_to_half(row[x][c]));
+    }
+  }
+
+  std::vector<std::uint8_t> tmp(raw.size());
+  std::size_t half = (raw.size() + 1) / 2;
+  for (std::size_t i = 0; i < raw.size(); ++i)
+    tmp[(i % 2 == 0 ? 0 : half) + i / 2] = raw[i];
+  for (std::size_t i = tmp.size() - 1; i > 0; --i)
+    tmp[i] = static_cast<std::uint8_t>(tmp[i] - tmp[i - 1] + 128);
+
+  uLongf size = compressBound(static_cast<uLong>(tmp.size()));
+  std::vector<std::uint8_t> out(size);
+  if (compress2(out.data(), &size, tmp.data(), static_cast<uLong>(tmp.size()),
+                level) != Z_OK ||
+      size >= raw.size())
+    return raw;
+  out.resize(size);
+  return out;
+}
+
+bool tpm::exr::Writer::open(const std::filesystem::path &path,
+                            const cl::sycl::uint3 &img_size,
+                            const int &zip_level) {
+  PFUNC(path.string(), img_size, zip_level);
+  size = img_size;
+  level = zip_level;
+  tiles = cl::sycl::uint2(size[0] / size[2] + (size[0] % size[2] ? 1 : 0),
+                          size[1] / size[2] + (size[1] % size[2] ? 1 : 0));
+  offsets.assign(static_cast<std::size_t>(tiles[0]) * tiles[1], 0);
+
+  file.open(path, std::ios::binary);
+  if (!file)
+    return false;
+
+  std::vector<std::uint8_t> header, value;
+  put(header, static_cast<std::int32_t>(20000630));
+  put(header, static_cast<std::int32_t>(2 | 0x200));
+
+  for (const char *name : {"B", "G", "R"}) {
+    value.push_back(static_cast<std::uint8_t>(name[0]));
+    value.push_back(0);
+    put(value, static_cast<std::int32_t>(half_type));
+    put(value, static_cast<std::int32_t>(0));
+    put(value, static_cast<std::int32_t>(1));
+    put(value, static_cast<std::int32_t>(1));
+  }
+  value.push_back(0);
+  put_attr(header, "channels", "chlist", value);
+  put_attr(header, "compression", "compression", {zip_compression});
+
+  value.clear();
+  put(value, static_cast<std::int32_t>(0));
+  put(value, static_cast<std::int32_t>(0));
+  put(value, static_cast<std::int32_t>(size[0] - 1));
+  put(value, static_cast<std::int32_t>(size[1] - 1));
+  put_attr(header, "dataWindow", "box2i", value);
+  put_attr(header, "displayWindow", "box2i", value);
+  put_attr(header, "lineOrder", "lineOrder", {random_y});
+
+  value.clear();
+  put(value, 1.0f);
+  put_attr(header, "pixelAspectRatio", "float", value);
+  value.clear();
+  put(value, 0.0f);
+  put(value, 0.0f);
+  put_attr(header, "screenWindowCenter", "v2f", value);
+  value.clear();
+  put(value, 1.0f);
+  put_attr(header, "screenWindowWidth", "float", value);
+
+  value.clear();
+  put(value, static_cast<std::uint32_t>(size[2]));
+  put(value, static_cast<std::uint32_t>(size[2]));
+  value.push_back(0);
+  put_attr(header, "tiles", "tiledesc", value);
+  header.push_back(0);
+
+  file.write(reinterpret_cast<const char *>(header.data()),
+             static_cast<std::streamsize>(header.size()));
+  table = static_cast<std::streamoff>(header.size());
+  std::vector<std::uint8_t> zeros(offsets.size() * sizeof(std::uint64_t), 0);
+  file.write(reinterpret_cast<const char *>(zeros.data()),
+             static_cast<std::streamsize>(zeros.size()));
+  return static_cast<bool>(file);
+}
+
+bool tpm::exr::Writer::write_tile(const cl::sycl::uint2 &tile,
+                                  const std::vector<std::uint8_t> &data) {
+  std::vector<std::uint8_t> head;
+  put(head, static_cast<std::int32_t>(tile[0]));
+  put(head, static_cast<std::int32_t>(tile[1]));
+  put(head, static_cast<std::int32_t>(0));
+  put(head, static_cast<std::int32_t>(0));
+  put(head, static_cast<std::int32_t>(data.size()));
+  offsets[tile[1] * tiles[0] + tile[0]] =
+      static_cast<std::uint64_t>(file.tellp());
+  file.write(reinterpret_cast<const char *>(head.data()),
+             static_cast<std::streamsize>(head.size()));
+  file.write(reinterpret_cast<const char *>(data.data()),
+             static_cast<std::streamsize>(data.size()));
+  return static_cast<bool>(file);
+}
+
+bool tpm::exr::Writer::write_tile(const cl::sycl::uint2 &tile,
+                                  const PixelView &data,
+                                  const std::uint32_t &stride) {
+  cl::sycl::uint4 rect = Image::tile(size, tile);
+  return write_tile(tile, encode_tile(data, stride, rect[2] - rect[0],
+                                      rect[3] - rect[1], level));
+}
+
+bool tpm::exr::Writer::write_rows(const PixelView &data,
+                                  const std::uint32_t &y0,
+                                  const std::uint32_t &y1) {
+  PFUNC(y0, y1);
+  if (y0 % size[2] != 0 || (y1 % size[2] != 0 && y1 != size[1]))
+    return false;
+  std::uint32_t ty0 = y0 / size[2],
+                ty1 = y1 / size[2] + (y1 % size[2] ? 1 : 0);
+  std::size_t count = static_cast<std::size_t>(ty1 - ty0) * tiles[0];
+  std::vector<std::vector<std::uint8_t>> encoded(count);
+  host_parallel_for(count, [&](const std::size_t &id) {
+    cl::sycl::uint4 rect = Image::tile(
+        size, cl::sycl::uint2(static_cast<std::uint32_t>(id % tiles[0]),
+                              ty0 + static_cast<std::uint32_t>(id / tiles[0])));
+    encoded[id] = encode_tile(data + (rect[1] - y0) * size[0] + rect[0],
+                              size[0], rect[2] - rect[0], rect[3] - rect[1],
+                              level);
+  });
+
+  bool ret = true;
+  for (std::size_t id = 0; id < count && ret; ++id)
+    ret = write_tile(
+        cl::sycl::uint2(static_cast<std::uint32_t>(id % tiles[0]),
+                        ty0 + static_cast<std::uint32_t>(id / tiles[0])),
+        encoded[id]);
+  return ret;
+}
+
+bool tpm::exr::Writer::close() {
+  PFUNC();
+  std::vector<std::uint8_t> table_data;
+  for (const std::uint64_t &offset : offsets)
+    put(table_data, offset);
+  file.seekp(table);
+  file.write(reinterpret_cast<const char *>(table_data.data()),
+             static_cast<std::streamsize>(table_data.size()));
+  file.close();
+  return !file.fail();
+}
+
+bool tpm::exr::write(const std::filesystem::path &path, const Image &img,
+                     const int &level) {
+  PFUNC(path.string(), &img, level);
+  Writer writer;
+  if (!writer.open(path, img.size, level))
+    return false;
+  bool ret = writer.write_rows(img.view(), 0, img.size[1]);
+  return writer.close() && ret;
+}
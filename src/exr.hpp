@@ -0,0 +1,45 @@
+#ifndef EXR_HPP_R6GJ0XAW
+#define EXR_HPP_R6GJ0XAW
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "render.hpp"
+
+namespace tpm::exr {
+
+std::vector<std::uint8_t> encode_tile(const PixelView &data,
+                                      const std::uint32_t &stride,
+                                      const std::uint32_t &width,
+                                      const std::uint32_t &height,
+                                      const int &level);
+
+struct Writer {
+  bool open(const std::filesystem::path &path, const cl::sycl::uint3 &size,
+            const int &level);
+  bool write_tile(const cl::sycl::uint2 &tile,
+                  const std::vector<std::uint8_t> &data);
+  bool write_tile(const cl::sycl::uint2 &tile, const PixelView &data,
+                  const std::uint32_t &stride);
+  bool write_rows(const PixelView &data, const std::uint32_t &y0,
+                  const std::uint32_t &y1);
+  bool close();
+
+  std::ofstream file;
+  cl::sycl::uint3 size;
+  cl::sycl::uint2 tiles;
+  int level = 6;
+  std::streamoff table = 0;
+  std::vector<std::uint64_t> offsets;
+};
+
+bool write(const std::filesystem::path &path, const Image &img,
+           const int &level);
+
+} // namespace tpm::exr
+
+#endif /* end of include guard: EXR_HPP_R6GJ0XAW */
@@ -0,0 +1,524 @@
+#include "farm.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <CL/sycl.hpp>
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+#include "device.hpp"
+#include "exit_code.hpp"
+#include "log.hpp"
+#include "net.hpp"
+#include "pool.hpp"
+#include "prof.hpp"
+#include "render.hpp"
+#include "scene.hpp"
+
+constexpr std::size_t max_scene_bytes = 64u << 20;
+constexpr int listen_backlog = 64;
+constexpr std::chrono::milliseconds poll_interval(250);
+constexpr long read_timeout_s = 30;
+constexpr std::size_t connect_attempts = 120;
+constexpr std::uint32_t batch_rounds = 2;
+constexpr std::uint32_t reissue_factor = 4;
+constexpr std::chrono::seconds min_reissue(2);
+constexpr std::uint32_t chunk_passes = 4;
+
+// A worker announces its lane count, receives the scene size and XML and
+// the coordinator's tile seeds once, then answers each "kind frame count"
+// line and its line of unit indices with the payload size and every unit's
+// outputs as packed rgb f32. Kind "t" units are tiles, sent as one full
+// tile of pixels per output. Kind "s" units are chunks of chunk_passes
+// progressive passes, sent as the chunk's mean over the whole image per
+// output. Tile seeds are a count line followed by packed u32 generator
+// states, so every unit draws the same samples on any worker as on the
+// coordinator.
+static std::string pack(const std::vector<cl::sycl::float3> &values) {
+  std::string data(values.size() * 3 * sizeof(float), '\0');
+  char *ptr = data.data();
+  for (const cl::sycl::float3 &v : values) {
+    float rgb[3] = {v.x(), v.y(), v.z()};
+    std::memcpy(ptr, rgb, sizeof(rgb));
+    ptr += sizeof(rgb);
+  }
+  return data;
+}
+
+static std::string pack_seeds(tpm::Renderer &renderer) {
+  auto seeds_ptr =
+      renderer.seeds_buffer.get_access<cl::sycl::access::mode::read>();
+  std::string data = fmt::format("{}\n", renderer.seeds.size());
+  std::size_t offset = data.size();
+  data.resize(offset + renderer.seeds.size() * 4 * sizeof(std::uint32_t));
+  char *ptr = data.data() + offset;
+  for (std::size_t i = 0; i < renderer.seeds.size(); ++i) {
+    std::uint32_t words[4] = {seeds_ptr[i][0], seeds_ptr[i][1],
+                              seeds_ptr[i][2], seeds_ptr[i][3]};
+    std::memcpy(ptr, words, sizeof(words));
+    ptr += sizeof(words);
+  }
+  return data;
+}
+
+static void unpack_seeds(const std::string &data, tpm::Renderer &renderer) {
+  auto seeds_ptr =
+      renderer.seeds_buffer.get_access<cl::sycl::access::mode::write>();
+  const char *ptr = data.data();
+  for (std::size_t i = 0; i < renderer.seeds.size(); ++i) {
+    std::uint32_t words[4];
+    std::memcpy(words, ptr, sizeof(words));
+    ptr += sizeof(words);
+    seeds_ptr[i] = cl::sycl::uint4(words[0], words[1], words[2], words[3]);
+  }
+}
+
+static cl::sycl::float3 unpack(const char *data, const std::size_t &index) {
+  float rgb[3];
+  std::memcpy(rgb, data + index * sizeof(rgb), sizeof(rgb));
+  return cl::sycl::float3(rgb[0], rgb[1], rgb[2]);
+}
+
+static std::uint32_t chunk_count(const std::uint32_t &passes) {
+  return (passes + chunk_passes - 1) / chunk_passes;
+}
+
+namespace tpm::farm {
+
+struct Worker {
+  int fd;
+  std::uint32_t lanes, frame = 0;
+  std::vector<std::uint32_t> units;
+  std::chrono::steady_clock::time_point issued{};
+};
+
+struct Coordinator {
+  Coordinator(const std::string &scene_xml, std::string tile_seeds,
+              const TpmSpec &spec, const Split &split_by,
+              const std::uint32_t &pass_count, const int &listen_fd);
+
+  void accept();
+  void drop(const std::size_t &index, const char *reason);
+  bool assign(Worker &worker);
+  bool collect(Worker &worker);
+  void merge();
+  void gather(const std::uint32_t &next);
+
+  const std::string &scene;
+  std::string seeds;
+  Split split;
+  std::uint32_t passes;
+  int listener;
+  cl::sycl::uint3 img_size;
+  cl::sycl::uint2 tile_size;
+  std::size_t output_count, area, pixels, unit_count, unit_size;
+  std::vector<AovType> aovs;
+  std::vector<Worker> workers;
+
+  std::uint32_t frame = 0;
+  std::deque<std::uint32_t> todo;
+  std::vector<std::uint32_t> issues;
+  std::vector<bool> done;
+  std::size_t remaining = 0;
+  std::vector<cl::sycl::float3> accum;
+  std::map<std::uint32_t, std::vector<cl::sycl::float3>> chunks;
+  std::uint32_t merged = 0, merged_passes = 0;
+
+  std::chrono::steady_clock::duration batch_time{};
+  std::size_t batches = 0;
+};
+
+} // namespace tpm::farm
+
+tpm::farm::Coordinator::Coordinator(const std::string &scene_xml,
+                                    std::string tile_seeds,
+                                    const TpmSpec &spec, const Split &split_by,
+                                    const std::uint32_t &pass_count,
+                                    const int &listen_fd)
+    : scene(scene_xml), seeds(std::move(tile_seeds)), split(split_by),
+      passes(pass_count), listener(listen_fd),
+      img_size(spec.image.width, spec.image.height, spec.image.tile),
+      tile_size(Image(img_size).tile_size()),
+      output_count(std::min(spec.image.outputs.size(), max_outputs)),
+      area(static_cast<std::size_t>(img_size[2]) * img_size[2]),
+      pixels(static_cast<std::size_t>(img_size[0]) * img_size[1]),
+      unit_count(split_by == TILES
+                     ? static_cast<std::size_t>(tile_size[0]) * tile_size[1]
+                     : chunk_count(pass_count)),
+      unit_size(output_count * (split_by == TILES ? area : pixels)) {
+  for (std::size_t i = 0; i < output_count; ++i)
+    aovs.push_back(spec.image.outputs[i].aov);
+}
+
+void tpm::farm::Coordinator::accept() {
+  int fd = ::accept(listener, nullptr, nullptr);
+  if (fd < 0)
+    return;
+  net::set_timeout(fd, read_timeout_s);
+  std::string line;
+  std::uint32_t lanes = 0;
+  if (!net::read_line(fd, line) ||
+      std::sscanf(line.c_str(), "%" SCNu32, &lanes) != 1 || lanes == 0 ||
+      !net::write_all(fd, fmt::format("{}\n{}", scene.size(), scene)) ||
+      !net::write_all(fd, seeds)) {
+    LWARN("Dropping worker that failed the handshake");
+    ::close(fd);
+    return;
+  }
+  workers.push_back(Worker{fd, lanes, 0, {}, {}});
+  LINFO("Worker {} joined with {} lanes ({} connected)", fd, lanes,
+        workers.size());
+}
+
+void tpm::farm::Coordinator::drop(const std::size_t &index,
+                                  const char *reason) {
+  Worker &worker = workers[index];
+  std::size_t lost = 0;
+  for (auto it = worker.units.rbegin(); it != worker.units.rend(); ++it) {
+    if (worker.frame == frame && !done[*it]) {
+      todo.push_front(*it);
+      ++lost;
+    }
+  }
+  LWARN("Dropping worker {} ({}), re-issuing {} units", worker.fd, reason,
+        lost);
+  ::close(worker.fd);
+  workers.erase(workers.begin() + static_cast<std::ptrdiff_t>(index));
+}
+
+bool tpm::farm::Coordinator::assign(Worker &worker) {
+  // A tile keeps one lane busy, while a sample chunk already spans the
+  // whole image and every lane.
+  std::size_t batch =
+      split == TILES ? static_cast<std::size_t>(worker.lanes) * batch_rounds
+                     : 1;
+  std::vector<std::uint32_t> units;
+  while (!todo.empty() && units.size() < batch) {
+    std::uint32_t unit = todo.front();
+    todo.pop_front();
+    if (!done[unit])
+      units.push_back(unit);
+  }
+
+  // Once the queue is drained an idle worker duplicates the units of one
+  // that is taking much longer than an average batch. The first result
+  // back wins.
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration slow = std::max<
+      std::chrono::steady_clock::duration>(
+      min_reissue,
+      batches == 0 ? std::chrono::steady_clock::duration::max() / 2
+                   : reissue_factor *
+                         (batch_time /
+                          static_cast<std::chrono::steady_clock::rep>(
+                              batches)));
+  for (std::size_t i = 0; units.empty() && i < workers.size(); ++i) {
+    const Worker &other = workers[i];
+    if (&other == &worker || other.units.empty() || other.frame != frame ||
+        now - other.issued < slow)
+      continue;
+    for (std::uint32_t unit : other.units) {
+      if (!done[unit] && issues[unit] == 1 && units.size() < batch)
+        units.push_back(unit);
+    }
+    if (!units.empty())
+      LINFO("Re-issuing {} units of slow worker {} to worker {}",
+            units.size(), other.fd, worker.fd);
+  }
+  if (units.empty())
+    return true;
+
+  for (std::uint32_t unit : units)
+    ++issues[unit];
+  worker.frame = frame;
+  worker.units = units;
+  worker.issued = now;
+  return net::write_all(
+      worker.fd, fmt::format("{} {} {}\n{}\n", split == TILES ? 't' : 's',
+                             frame, units.size(), fmt::join(units, " ")));
+}
+
+// Chunks are folded in index order as a weighted running mean, so the
+// floating point result does not depend on how many workers rendered them
+// or in which order they arrived.
+void tpm::farm::Coordinator::merge() {
+  for (auto it = chunks.find(merged); it != chunks.end();
+       it = chunks.find(merged)) {
+    std::uint32_t first = merged * chunk_passes;
+    std::uint32_t count = std::min(chunk_passes, passes - first);
+    merged_passes += count;
+    const std::vector<cl::sycl::float3> &mean = it->second;
+    for (std::size_t i = 0; i < output_count; ++i) {
+      // Depth, normal and material ids keep the first pass, as in a local
+      // progressive render.
+      if (merged != 0 && aovs[i] != BEAUTY && aovs[i] != STEPS)
+        continue;
+      for (std::size_t p = i * pixels; p < (i + 1) * pixels; ++p) {
+        if (merged == 0)
+          accum[p] = mean[p];
+        else
+          accum[p] += (mean[p] - accum[p]) * static_cast<float>(count) /
+                      static_cast<float>(merged_passes);
+      }
+    }
+    chunks.erase(it);
+    ++merged;
+  }
+}
+
+bool tpm::farm::Coordinator::collect(Worker &worker) {
+  PFUNC(worker.fd, worker.units.size());
+  std::string line, data;
+  std::size_t size = 0,
+              expected = worker.units.size() * unit_size * 3 * sizeof(float);
+  if (!net::read_line(worker.fd, line) ||
+      std::sscanf(line.c_str(), "%zu", &size) != 1 || size != expected ||
+      !net::read_exact(worker.fd, data, size))
+    return false;
+
+  // A late reply for a frame that was already gathered is discarded.
+  for (std::size_t k = 0; worker.frame == frame && k < worker.units.size();
+       ++k) {
+    std::uint32_t unit = worker.units[k];
+    if (done[unit])
+      continue;
+    const char *src = data.data() + k * unit_size * 3 * sizeof(float);
+    if (split == SAMPLES) {
+      std::vector<cl::sycl::float3> &mean = chunks[unit];
+      mean.resize(unit_size);
+      for (std::size_t p = 0; p < unit_size; ++p)
+        mean[p] = unpack(src, p);
+    } else {
+      cl::sycl::uint4 tile = Image::tile(
+          img_size, cl::sycl::uint2(unit / tile_size[1], unit % tile_size[1]));
+      for (std::size_t i = 0; i < output_count; ++i) {
+        for (std::uint32_t y = tile[1]; y < tile[3]; ++y) {
+          for (std::uint32_t x = tile[0]; x < tile[2]; ++x)
+            accum[i * pixels + Image::idx(img_size, cl::sycl::uint2(x, y))] =
+                unpack(src, i * area + (y - tile[1]) * img_size[2] +
+                                (x - tile[0]));
+        }
+      }
+    }
+    done[unit] = true;
+    --remaining;
+  }
+  if (split == SAMPLES)
+    merge();
+  batch_time += std::chrono::steady_clock::now() - worker.issued;
+  ++batches;
+  worker.units.clear();
+  return true;
+}
+
+void tpm::farm::Coordinator::gather(const std::uint32_t &next) {
+  PFUNC(next);
+  frame = next;
+  todo.clear();
+  for (std::uint32_t unit = 0; unit < unit_count; ++unit)
+    todo.push_back(unit);
+  issues.assign(unit_count, 0);
+  done.assign(unit_count, false);
+  remaining = unit_count;
+  accum.assign(pixels * output_count, cl::sycl::float3(0.0f));
+  chunks.clear();
+  merged = merged_passes = 0;
+
+  bool waiting = false;
+  while (remaining != 0) {
+    for (std::size_t i = workers.size(); i-- > 0;) {
+      if (workers[i].units.empty() && !assign(workers[i]))
+        drop(i, "send failed");
+    }
+    if (workers.empty() && !waiting)
+      LWARN("Waiting for workers with {} of {} units left", remaining,
+            unit_count);
+    waiting = workers.empty();
+
+    std::vector<pollfd> pfds{pollfd{listener, POLLIN, 0}};
+    for (const Worker &worker : workers)
+      pfds.push_back(pollfd{worker.fd, POLLIN, 0});
+    if (::poll(pfds.data(), pfds.size(),
+               static_cast<int>(poll_interval.count())) <= 0)
+      continue;
+    for (std::size_t i = workers.size(); i-- > 0;) {
+      if (pfds[i + 1].revents == 0)
+        continue;
+      if (workers[i].units.empty())
+        drop(i, "disconnected");
+      else if (!collect(workers[i]))
+        drop(i, "bad reply");
+    }
+    if (pfds[0].revents != 0)
+      accept();
+  }
+  LINFO("Gathered frame {} from {} workers over {} batches", frame,
+        workers.size(), batches);
+}
+
+std::string tpm::farm::default_address() { return "127.0.0.1:7878"; }
+
+tpm::ExitCode tpm::farm::coordinate(const std::string &address,
+                                    const std::string &scene,
+                                    const TpmSpec &spec, const Split &split,
+                                    WritePool &pool) {
+  PFUNC(address, scene.size());
+  if (scene.empty() || scene.size() > max_scene_bytes) {
+    LERR("Scene of {} bytes can not be sent to workers", scene.size());
+    return SCENE_PARSE_ERROR;
+  }
+  device::Slice slice;
+  ExitCode selected = device::select_one(spec.device.select, slice);
+  if (selected != OK)
+    return selected;
+  int listener = net::listen(address, listen_backlog);
+  if (listener < 0)
+    return SOCKET_ERROR;
+
+  TpmSpec local = spec;
+  if (slice.cores != 0 && local.renderer.cores == 0)
+    local.renderer.cores = slice.cores;
+  Renderer renderer(local, cl::sycl::queue(slice.device));
+  Coordinator coordinator(scene, pack_seeds(renderer), spec, split,
+                          renderer.passes(), listener);
+  LINFO("Coordinating {} {} per frame on \"{}\"", coordinator.unit_count,
+        split == TILES ? "tiles" : "sample chunks", address);
+  ExitCode status = OK;
+  for (std::uint32_t frame = spec.sequence.start;
+       status == OK && frame <= spec.sequence.end; ++frame) {
+    LINFO("Distributing frame {} of {}-{}", frame, spec.sequence.start,
+          spec.sequence.end);
+    coordinator.gather(frame);
+    status = renderer.render(frame, pool, &coordinator.accum);
+  }
+
+  for (const Worker &worker : coordinator.workers)
+    ::close(worker.fd);
+  ::close(listener);
+  if (!net::is_tcp(address))
+    ::unlink(address.c_str());
+  return status;
+}
+
+tpm::ExitCode tpm::farm::work(const std::string &address,
+                              const std::uint32_t &cores,
+                              const std::string &selector) {
+  PFUNC(address, cores);
+  // Workers may be started before the coordinator, so keep trying for a
+  // while before giving up.
+  int fd = net::connect(address);
+  for (std::size_t attempt = 1; fd < 0 && attempt < connect_attempts;
+       ++attempt) {
+    std::this_thread::sleep_for(poll_interval);
+    fd = net::connect(address);
+  }
+  if (fd < 0) {
+    LERR("Failed to connect to coordinator at \"{}\"", address);
+    return SOCKET_ERROR;
+  }
+
+  std::uint32_t lanes =
+      cores != 0 ? cores : std::max(1u, std::thread::hardware_concurrency());
+  std::string line, scene, seeds;
+  std::size_t size = 0, seed_count = 0;
+  if (!net::write_all(fd, fmt::format("{}\n", lanes)) ||
+      !net::read_line(fd, line) ||
+      std::sscanf(line.c_str(), "%zu", &size) != 1 || size == 0 ||
+      size > max_scene_bytes || !net::read_exact(fd, scene, size) ||
+      !net::read_line(fd, line) ||
+      std::sscanf(line.c_str(), "%zu", &seed_count) != 1 ||
+      seed_count > max_scene_bytes / sizeof(cl::sycl::uint4) ||
+      !net::read_exact(fd, seeds,
+                       seed_count * 4 * sizeof(std::uint32_t))) {
+    LERR("Coordinator at \"{}\" dropped the handshake", address);
+    ::close(fd);
+    return SOCKET_ERROR;
+  }
+  auto [status, spec] = parse_spec_string(scene);
+  if (status != OK) {
+    ::close(fd);
+    return status;
+  }
+  spec.renderer.cores = cores;
+  device::Slice slice;
+  status = device::select_one(selector.empty() ? spec.device.select : selector,
+                              slice);
+  if (status != OK) {
+    ::close(fd);
+    return status;
+  }
+  if (slice.cores != 0 && spec.renderer.cores == 0)
+    spec.renderer.cores = slice.cores;
+
+  Renderer renderer(spec, cl::sycl::queue(slice.device));
+  std::size_t tile_count =
+      static_cast<std::size_t>(renderer.tile_size[0]) * renderer.tile_size[1];
+  if (seed_count != tile_count) {
+    LERR("Coordinator sent {} tile seeds for {} tiles", seed_count,
+         tile_count);
+    ::close(fd);
+    return SOCKET_ERROR;
+  }
+  unpack_seeds(seeds, renderer);
+  std::uint32_t passes = renderer.passes();
+  std::size_t rendered = 0;
+  std::vector<cl::sycl::float3> out;
+  LINFO("Rendering for coordinator at \"{}\" on {} lanes", address, lanes);
+  // The coordinator closes the connection once the sequence is done.
+  while (net::read_line(fd, line)) {
+    char kind = 0;
+    std::uint32_t frame = 0;
+    std::size_t count = 0;
+    if (std::sscanf(line.c_str(), "%c %" SCNu32 " %zu", &kind, &frame,
+                    &count) != 3 ||
+        (kind != 't' && kind != 's') || !net::read_line(fd, line)) {
+      status = SOCKET_ERROR;
+      break;
+    }
+    std::size_t limit = kind == 't' ? tile_count : chunk_count(passes);
+    std::vector<std::uint32_t> units;
+    std::istringstream ids(line);
+    for (std::uint32_t unit; ids >> unit && unit < limit;)
+      units.push_back(unit);
+    if (units.size() != count) {
+      LERR("Malformed assignment from coordinator");
+      status = SOCKET_ERROR;
+      break;
+    }
+
+    std::string data;
+    if (kind == 't') {
+      renderer.render_tiles(frame, units, out);
+      data = pack(out);
+    }
+    for (std::size_t k = 0; kind == 's' && k < units.size(); ++k) {
+      std::uint32_t first = units[k] * chunk_passes;
+      renderer.render_passes(frame, first,
+                             std::min(chunk_passes, passes - first), out);
+      data += pack(out);
+    }
+    if (!net::write_all(fd, fmt::format("{}\n", data.size())) ||
+        !net::write_all(fd, data))
+      break;
+    rendered += count;
+  }
+  LINFO("Rendered {} units for coordinator at \"{}\"", rendered, address);
+  ::close(fd);
+  return status;
+}
@@ -0,0 +1,27 @@
+#ifndef FARM_HPP_Z5TB1MKR
+#define FARM_HPP_Z5TB1MKR
+
+#include <cstdint>
+#include <string>
+
+#include "exit_code.hpp"
+#include "pool.hpp"
+#include "scene.hpp"
+
+namespace tpm::farm {
+
+// Frames are split either into tiles of the image or into ranges of
+// progressive passes over the whole image.
+enum Split { TILES, SAMPLES };
+
+std::string default_address();
+ExitCode coordinate(const std::string &address, const std::string &scene,
+                    const TpmSpec &spec, const Split &split, WritePool &pool);
+// The coordinator renders on the scene's device selection. Workers use
+// their own selector, or the scene's when it is empty.
+ExitCode work(const std::string &address, const std::uint32_t &cores = 0,
+              const std::string &selector = "");
+
+} // namespace tpm::farm
+
+#endif /* end of include guard: FARM_HPP_Z5TB1MKR */
@@ -0,0 +1,57 @@
+#ifndef HALF_HPP_PZ4MCE1L
+#define HALF_HPP_PZ4MCE1L
+
+#include <cstdint>
+#include <cstring>
+
+namespace tpm {
+
+inline std::uint16_t float_to_half(const float &f) {
+  std::uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  std::uint32_t sign = x & 0x80000000u;
+  x ^= sign;
+  std::uint32_t o;
+  if (x >= 0x47800000u) {
+    o = x > 0x7F800000u ? 0x7E00u : 0x7C00u;
+  } else if (x < 0x38800000u) {
+    const std::uint32_t magic = ((127 - 15) + (23 - 10) + 1) << 23;
+    float a, b;
+    std::memcpy(&a, &x, sizeof(a));
+    std::memcpy(&b, &magic, sizeof(b));
+    a += b;
+    std::memcpy(&o, &a, sizeof(o));
+    o -= magic;
+  } else {
+    std::uint32_t odd = (x >> 13) & 1u;
+    x += 0xC8000FFFu + odd;
+    o = x >> 13;
+  }
+  return static_cast<std::uint16_t>((sign >> 16) | o);
+}
+
+inline float half_to_float(const std::uint16_t &h) {
+  const std::uint32_t shifted_exp = 0x7C00u << 13;
+  std::uint32_t o = (static_cast<std::uint32_t>(h) & 0x7FFFu) << 13;
+  std::uint32_t exp = shifted_exp & o;
+  o += (127 - 15) << 23;
+  if (exp == shifted_exp) {
+    o += (128 - 16) << 23;
+  } else if (exp == 0) {
+    const std::uint32_t magic = 113 << 23;
+    float a, b;
+    o += 1 << 23;
+    std::memcpy(&a, &o, sizeof(a));
+    std::memcpy(&b, &magic, sizeof(b));
+    a -= b;
+    std::memcpy(&o, &a, sizeof(o));
+  }
+  o |= (static_cast<std::uint32_t>(h) & 0x8000u) << 16;
+  float f;
+  std::memcpy(&f, &o, sizeof(f));
+  return f;
+}
+
+} // namespace tpm
+
+#endif /* end of include guard: HALF_HPP_PZ4MCE1L */
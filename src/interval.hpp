@@ -0,0 +1,114 @@
+#ifndef INTERVAL_HPP_HN4C0TRB
+#define INTERVAL_HPP_HN4C0TRB
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <CL/sycl.hpp>
+
+namespace tpm {
+
+struct Interval {
+  Interval() : lo(0.0f), hi(0.0f) {}
+  Interval(const float &v) : lo(v), hi(v) {}
+  Interval(const float &lo, const float &hi) : lo(lo), hi(hi) {}
+
+  float lo, hi;
+};
+
+inline Interval operator-(const Interval &a) { return Interval(-a.hi, -a.lo); }
+inline Interval operator+(const Interval &a, const Interval &b) {
+  return Interval(a.lo + b.lo, a.hi + b.hi);
+}
+inline Interval operator-(const Interval &a, const Interval &b) {
+  return Interval(a.lo - b.hi, a.hi - b.lo);
+}
+inline Interval operator*(const Interval &a, const Interval &b) {
+  float p[4] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+  return Interval(std::min(std::min(p[0], p[1]), std::min(p[2], p[3])),
+                  std::max(std::max(p[0], p[1]), std::max(p[2], p[3])));
+}
+inline Interval operator/(const Interval &a, const Interval &b) {
+  if (b.lo <= 0.0f && b.hi >= 0.0f)
+    return Interval(-std::numeric_limits<float>::infinity(),
+                    std::numeric_limits<float>::infinity());
+  return a * Interval(1.0f / b.hi, 1.0f / b.lo);
+}
+
+inline Interval sqr(const Interval &a) {
+  if (a.lo >= 0.0f)
+    return Interval(a.lo * a.lo, a.hi * a.hi);
+  if (a.hi <= 0.0f)
+    return Interval(a.hi * a.hi, a.lo * a.lo);
+  float m = std::max(-a.lo, a.hi);
+  return Interval(0.0f, m * m);
+}
+inline Interval sqrt(const Interval &a) {
+  return Interval(std::sqrt(std::max(a.lo, 0.0f)),
+                  std::sqrt(std::max(a.hi, 0.0f)));
+}
+inline Interval fabs(const Interval &a) {
+  if (a.lo >= 0.0f)
+    return a;
+  if (a.hi <= 0.0f)
+    return -a;
+  return Interval(0.0f, std::max(-a.lo, a.hi));
+}
+inline Interval min(const Interval &a, const Interval &b) {
+  return Interval(std::min(a.lo, b.lo), std::min(a.hi, b.hi));
+}
+inline Interval max(const Interval &a, const Interval &b) {
+  return Interval(std::max(a.lo, b.lo), std::max(a.hi, b.hi));
+}
+inline Interval clamp(const Interval &a, const Interval &lo,
+                      const Interval &hi) {
+  return min(max(a, lo), hi);
+}
+inline Interval sign(const Interval &a) {
+  return Interval(a.lo < 0.0f ? -1.0f : (a.lo > 0.0f ? 1.0f : 0.0f),
+                  a.hi < 0.0f ? -1.0f : (a.hi > 0.0f ? 1.0f : 0.0f));
+}
+inline Interval sin(const Interval &) { return Interval(-1.0f, 1.0f); }
+inline Interval cos(const Interval &) { return Interval(-1.0f, 1.0f); }
+
+struct Interval3 {
+  Interval3() : v{Interval(), Interval(), Interval()} {}
+  Interval3(const Interval &x, const Interval &y, const Interval &z)
+      : v{x, y, z} {}
+
+  inline Interval &operator[](const int &i) { return v[i]; }
+  inline const Interval &operator[](const int &i) const { return v[i]; }
+
+  Interval v[3];
+};
+
+inline Interval3 operator+(const Interval3 &a, const cl::sycl::float3 &b) {
+  return Interval3(a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+}
+inline Interval3 operator-(const Interval3 &a, const cl::sycl::float3 &b) {
+  return Interval3(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+}
+inline Interval3 operator*(const Interval &a, const Interval3 &b) {
+  return Interval3(a * b[0], a * b[1], a * b[2]);
+}
+
+inline Interval3 fabs(const Interval3 &a) {
+  return Interval3(fabs(a[0]), fabs(a[1]), fabs(a[2]));
+}
+inline Interval3 min(const Interval3 &a, const Interval &b) {
+  return Interval3(min(a[0], b), min(a[1], b), min(a[2], b));
+}
+inline Interval3 max(const Interval3 &a, const Interval &b) {
+  return Interval3(max(a[0], b), max(a[1], b), max(a[2], b));
+}
+inline Interval dot(const Interval3 &a, const Interval3 &b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+inline Interval length(const Interval3 &a) {
+  return sqrt(sqr(a[0]) + sqr(a[1]) + sqr(a[2]));
+}
+
+} // namespace tpm
+
+#endif /* end of include guard: INTERVAL_HPP_HN4C0TRB */
@@ -1,6 +1,13 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <ostream>
+#include <random>
+#include <string>
+#include <vector>
 
 #if defined(_WIN32) || defined(_WIN64)
 #define NOMINMAX
@@ -22,11 +29,15 @@
 #include <spdlog/sinks/basic_file_sink.h>
 
 #define PL_IMPLEMENTATION 1
+#include "device.hpp"
 #include "exit_code.hpp"
+#include "farm.hpp"
 #include "log.hpp"
+#include "pool.hpp"
 #include "prof.hpp"
 #include "render.hpp"
 #include "scene.hpp"
+#include "serve.hpp"
 #include "version.hpp"
 
 int main(int argc, const char **argv) {
@@ -45,8 +56,51 @@ int main(int argc, const char **argv) {
     ("V,version", "Display detailed version information")
     ("I,info", "Display detailed application information");
 
+  options.add_options("Daemon")
+    ("serve", "Run as a render daemon listening on a socket",
+     cxxopts::value<std::string>()->implicit_value(tpm::serve::default_socket()))
+    ("submit", "Render through a running daemon and wait for the job",
+     cxxopts::value<std::string>()->implicit_value(tpm::serve::default_socket()))
+    ("priority", "Daemon job priority, higher runs first",
+     cxxopts::value<int>()->default_value("0"))
+    ("j,jobs", "Number of jobs the daemon renders concurrently",
+     cxxopts::value<std::size_t>()->default_value("1"))
+    ("cores", "Cap on cores per job, 0 for the default share",
+     cxxopts::value<std::uint32_t>()->default_value("0"));
+
+  options.add_options("Device")
+    ("device", "Devices to render on: default, all, cpu, gpu, host, an index "
+     "from --list-devices or part of a device or backend name, comma "
+     "separated; host and cpu terms take :N to split into N slices or :numa "
+     "for one slice per NUMA node",
+     cxxopts::value<std::string>())
+    ("multi-device", "Split tiles across all selected devices")
+    ("list-devices", "List the available SYCL devices and backends");
+
+  options.add_options("Distributed")
+    ("coordinate", "Split frames into tiles for workers connecting to this "
+     "address (host:port or a socket path)",
+     cxxopts::value<std::string>()->implicit_value(tpm::farm::default_address()))
+    ("work", "Render tiles for the coordinator at this address",
+     cxxopts::value<std::string>()->implicit_value(tpm::farm::default_address()))
+    ("split", "Split frames across workers by tiles or by samples",
+     cxxopts::value<std::string>()->default_value("tiles"));
+
   options.add_options()
-    ("scene", "Scene description file", cxxopts::value<std::string>());
+    ("o,output", "Override the path of the first output",
+     cxxopts::value<std::string>())
+    ("time-budget", "Render progressive passes for at most this many "
+     "milliseconds per frame", cxxopts::value<std::uint32_t>())
+    ("seed", "Scene seed for the sample generators, random by default",
+     cxxopts::value<std::uint32_t>())
+    ("checkpoint", "Periodically save the state of progressive frames to "
+     "this file", cxxopts::value<std::string>())
+    ("checkpoint-interval", "Seconds between checkpoints",
+     cxxopts::value<std::uint32_t>())
+    ("resume", "Continue a render from a checkpoint file",
+     cxxopts::value<std::string>())
+    ("scene", "Scene description file, or - for XML on stdin",
+     cxxopts::value<std::string>());
   options.parse_positional({"scene"});
   // clang-format on
 
@@ -65,6 +119,9 @@ int main(int argc, const char **argv) {
   } else if (result.count("version") != 0) {
     std::cout << tpm::version::semver << std::endl;
     status = tpm::ExitCode::EXIT_OK;
+  } else if (result.count("list-devices") != 0) {
+    tpm::device::list();
+    status = tpm::ExitCode::EXIT_OK;
   }
 
   PBEGIN("Logging");
@@ -108,18 +165,128 @@ int main(int argc, const char **argv) {
   PEND("Setup");
 
   tpm::TpmSpec tpm_spec;
-  if (status == tpm::ExitCode::OK && result.count("scene") != 0) {
-    std::tie(status, tpm_spec) =
-        tpm::parse_spec(result["scene"].as<std::string>());
+  std::string xml;
+  if (status == tpm::ExitCode::OK && result.count("serve") != 0) {
+    status = tpm::serve::run(
+        result["serve"].as<std::string>(), result["jobs"].as<std::size_t>(),
+        result["cores"].as<std::uint32_t>(),
+        result.count("device") != 0 ? result["device"].as<std::string>()
+                                    : std::string());
+    if (status == tpm::ExitCode::OK)
+      status = tpm::ExitCode::EXIT_OK;
+  } else if (status == tpm::ExitCode::OK && result.count("work") != 0) {
+    status = tpm::farm::work(
+        result["work"].as<std::string>(), result["cores"].as<std::uint32_t>(),
+        result.count("device") != 0 ? result["device"].as<std::string>()
+                                    : std::string());
+    if (status == tpm::ExitCode::OK)
+      status = tpm::ExitCode::EXIT_OK;
   } else if (result.count("scene") == 0) {
     LERR("Scene definition file is required!");
     status = tpm::ExitCode::ARGPARSE_MISSING_POSITIONAL;
+  } else if (status == tpm::ExitCode::OK && result.count("submit") != 0) {
+    tpm::serve::Job job;
+    job.priority = result["priority"].as<int>();
+    job.cores = result["cores"].as<std::uint32_t>();
+    if (result.count("time-budget") != 0)
+      job.budget = result["time-budget"].as<std::uint32_t>();
+    job.scene = result["scene"].as<std::string>();
+    if (job.scene == "-") {
+      job.scene.assign(std::istreambuf_iterator<char>(std::cin),
+                       std::istreambuf_iterator<char>());
+      job.scene.erase(0, job.scene.find_first_not_of(" \t\r\n"));
+    }
+    if (result.count("output") != 0)
+      job.output = result["output"].as<std::string>();
+    job.cwd = std::filesystem::current_path().string();
+    status = tpm::serve::submit(result["submit"].as<std::string>(), job);
+    if (status == tpm::ExitCode::OK)
+      status = tpm::ExitCode::EXIT_OK;
+  } else if (status == tpm::ExitCode::OK) {
+    std::string scene = result["scene"].as<std::string>();
+    if (scene == "-") {
+      xml.assign(std::istreambuf_iterator<char>(std::cin),
+                 std::istreambuf_iterator<char>());
+      std::tie(status, tpm_spec) = tpm::parse_spec_string(xml);
+    } else {
+      std::tie(status, tpm_spec) = tpm::parse_spec(scene);
+      // Workers get the scene itself rather than a path they may not share.
+      if (result.count("coordinate") != 0) {
+        std::ifstream file(scene, std::ios::binary);
+        xml.assign(std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>());
+      }
+    }
+    if (result.count("output") != 0 && !tpm_spec.image.outputs.empty())
+      tpm_spec.image.outputs.front().path = result["output"].as<std::string>();
+    if (result["cores"].as<std::uint32_t>() != 0)
+      tpm_spec.renderer.cores = result["cores"].as<std::uint32_t>();
+    if (result.count("time-budget") != 0)
+      tpm_spec.renderer.budget = result["time-budget"].as<std::uint32_t>();
+    if (result.count("seed") != 0)
+      tpm_spec.renderer.seed = result["seed"].as<std::uint32_t>();
+    // Device lanes and distributed workers draw from one scene seed, so a
+    // frame does not depend on which of them rendered a tile.
+    if (!tpm_spec.renderer.seed)
+      tpm_spec.renderer.seed = std::random_device()();
+    if (result.count("checkpoint") != 0)
+      tpm_spec.checkpoint.path = result["checkpoint"].as<std::string>();
+    if (result.count("checkpoint-interval") != 0)
+      tpm_spec.checkpoint.interval =
+          result["checkpoint-interval"].as<std::uint32_t>();
+    if (result.count("resume") != 0)
+      tpm_spec.checkpoint.resume = result["resume"].as<std::string>();
+    if (result.count("device") != 0)
+      tpm_spec.device.select = result["device"].as<std::string>();
+    if (result.count("multi-device") != 0)
+      tpm_spec.device.multi = true;
   }
 
   /*   status = tpm::render_frame(); */
 
-  if (status == tpm::ExitCode::OK)
-    status = tpm::render_frame(std::move(tpm_spec));
+  if (status == tpm::ExitCode::OK) {
+    std::size_t outputs = tpm_spec.image.outputs.size();
+    tpm::WritePool pool(outputs, 2 * outputs);
+    std::string split = result["split"].as<std::string>();
+    if (result.count("coordinate") != 0 && split != "tiles" &&
+        split != "samples") {
+      LERR("Unknown split \"{}\", expected tiles or samples", split);
+      status = tpm::ExitCode::ARGPARSE_INVALID_VALUE;
+    } else if (result.count("coordinate") != 0) {
+      status = tpm::farm::coordinate(
+          result["coordinate"].as<std::string>(), xml, tpm_spec,
+          split == "samples" ? tpm::farm::SAMPLES : tpm::farm::TILES, pool);
+    } else {
+      std::vector<tpm::device::Slice> slices =
+          tpm::device::select(tpm_spec.device.select);
+      if (slices.empty()) {
+        LERR("No SYCL device matches \"{}\"", tpm_spec.device.select);
+        status = tpm::ExitCode::DEVICE_ERROR;
+      } else if (tpm_spec.device.multi && slices.size() > 1) {
+        if (tpm_spec.renderer.budget != 0 ||
+            !tpm_spec.checkpoint.path.empty() ||
+            !tpm_spec.checkpoint.resume.empty())
+          LWARN("Time budgets and checkpoints only apply to single device "
+                "renders");
+        status = tpm::device::render_split(tpm_spec, slices, pool);
+      } else {
+        LINFO("Rendering on {}",
+              slices.front()
+                  .device.get_info<cl::sycl::info::device::name>());
+        if (slices.front().cores != 0 && tpm_spec.renderer.cores == 0)
+          tpm_spec.renderer.cores = slices.front().cores;
+        tpm::Renderer renderer(tpm_spec,
+                               cl::sycl::queue(slices.front().device));
+        if (!tpm_spec.checkpoint.resume.empty())
+          status = renderer.restore(tpm_spec.checkpoint.resume);
+        if (status == tpm::ExitCode::OK)
+          status = renderer.render_sequence(pool);
+      }
+    }
+    tpm::ExitCode write_status = pool.close();
+    if (status == tpm::ExitCode::OK)
+      status = write_status;
+  }
 
   PSTOP();
   if (status == tpm::ExitCode::EXIT_OK)
@@ -0,0 +1,58 @@
+#include "mapped.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "log.hpp"
+#include "prof.hpp"
+
+tpm::MappedFile::~MappedFile() { close(); }
+
+bool tpm::MappedFile::open(const std::filesystem::path &path,
+                           const std::size_t &bytes) {
+  PFUNC(path.string(), bytes);
+  close();
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LWARN("Failed to open \"{}\" for mapping", path.string());
+    return false;
+  }
+  if (::ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+    LWARN("Failed to resize \"{}\" to {} bytes", path.string(), bytes);
+    close();
+    return false;
+  }
+  void *ptr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    LWARN("Failed to map \"{}\"", path.string());
+    close();
+    return false;
+  }
+  data = static_cast<std::uint8_t *>(ptr);
+  size = bytes;
+  return true;
+}
+
+bool tpm::MappedFile::flush() const {
+  return data == nullptr || ::msync(data, size, MS_ASYNC) == 0;
+}
+
+bool tpm::MappedFile::close() {
+  bool ret = true;
+  if (data != nullptr) {
+    ret = flush() && ret;
+    ret = ::munmap(data, size) == 0 && ret;
+    data = nullptr;
+    size = 0;
+  }
+  if (fd >= 0) {
+    ret = ::close(fd) == 0 && ret;
+    fd = -1;
+  }
+  return ret;
+}
@@ -0,0 +1,27 @@
+#ifndef MAPPED_HPP_V3RB8TNE
+#define MAPPED_HPP_V3RB8TNE
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace tpm {
+
+struct MappedFile {
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+
+  bool open(const std::filesystem::path &path, const std::size_t &size);
+  bool flush() const;
+  bool close();
+
+  std::uint8_t *data = nullptr;
+  std::size_t size = 0;
+  int fd = -1;
+};
+
+} // namespace tpm
+
+#endif /* end of include guard: MAPPED_HPP_V3RB8TNE */
@@ -0,0 +1,190 @@
+#include "net.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.hpp"
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool split_tcp(const std::string &address, std::string &host,
+                      std::string &port) {
+  std::size_t colon = address.rfind(':');
+  if (colon == std::string::npos || colon + 1 == address.size() ||
+      address.find('/') != std::string::npos)
+    return false;
+  port = address.substr(colon + 1);
+  if (!std::all_of(port.begin(), port.end(),
+                   [](unsigned char c) { return std::isdigit(c) != 0; }))
+    return false;
+  host = address.substr(0, colon);
+  return true;
+}
+
+static addrinfo *resolve_tcp(const std::string &address, const bool &passive) {
+  std::string host, port;
+  split_tcp(address, host, port);
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  addrinfo *info = nullptr;
+  int ret = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+                          &hints, &info);
+  if (ret != 0) {
+    LERR("Failed to resolve \"{}\": {}", address, ::gai_strerror(ret));
+    return nullptr;
+  }
+  return info;
+}
+
+static bool unix_address(const std::string &path, sockaddr_un &addr) {
+  if (path.size() >= sizeof(addr.sun_path)) {
+    LERR("Socket path \"{}\" is too long", path);
+    return false;
+  }
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return true;
+}
+
+bool tpm::net::is_tcp(const std::string &address) {
+  std::string host, port;
+  return split_tcp(address, host, port);
+}
+
+int tpm::net::listen(const std::string &address, const int &backlog) {
+  int fd = -1;
+  if (is_tcp(address)) {
+    addrinfo *info = resolve_tcp(address, true);
+    for (addrinfo *ai = info; ai != nullptr && fd < 0; ai = ai->ai_next) {
+      fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0)
+        continue;
+      int on = 1;
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      if (::bind(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        ::close(fd);
+        fd = -1;
+      }
+    }
+    if (info != nullptr)
+      ::freeaddrinfo(info);
+  } else {
+    sockaddr_un addr;
+    if (!unix_address(address, addr))
+      return -1;
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(address.c_str());
+    if (fd >= 0 &&
+        ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  if (fd < 0 || ::listen(fd, backlog) != 0) {
+    LERR("Failed to listen on \"{}\": {}", address, std::strerror(errno));
+    if (fd >= 0)
+      ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int tpm::net::connect(const std::string &address) {
+  int fd = -1;
+  if (is_tcp(address)) {
+    addrinfo *info = resolve_tcp(address, false);
+    for (addrinfo *ai = info; ai != nullptr && fd < 0; ai = ai->ai_next) {
+      fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0)
+        continue;
+      if (::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        ::close(fd);
+        fd = -1;
+        continue;
+      }
+      // Requests and replies are small line headers followed by payloads,
+      // so waiting to coalesce them only adds latency.
+      int on = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (info != nullptr)
+      ::freeaddrinfo(info);
+    return fd;
+  }
+  sockaddr_un addr;
+  if (!unix_address(address, addr))
+    return -1;
+  fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 &&
+      ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+void tpm::net::set_timeout(const int &fd, const long &seconds) {
+  timeval timeout{seconds, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+// Sends with MSG_NOSIGNAL, so a peer that hung up fails the write with
+// EPIPE instead of raising SIGPIPE in the whole process.
+bool tpm::net::write_all(const int &fd, const std::string &data) {
+  for (std::size_t sent = 0; sent < data.size();) {
+    ssize_t n =
+        ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    sent += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool tpm::net::read_exact(const int &fd, std::string &data,
+                          const std::size_t &size) {
+  data.resize(size);
+  for (std::size_t got = 0; got < size;) {
+    ssize_t n = ::read(fd, data.data() + got, size - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    got += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool tpm::net::read_line(const int &fd, std::string &line) {
+  line.clear();
+  char c;
+  while (true) {
+    ssize_t n = ::read(fd, &c, 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    if (c == '\n')
+      return true;
+    line.push_back(c);
+  }
+}
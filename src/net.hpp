@@ -0,0 +1,22 @@
+#ifndef NET_HPP_H3LC8WQB
+#define NET_HPP_H3LC8WQB
+
+#include <cstddef>
+#include <string>
+
+namespace tpm::net {
+
+// Addresses of the form host:port are TCP, anything else is a Unix socket
+// path.
+bool is_tcp(const std::string &address);
+int listen(const std::string &address, const int &backlog);
+int connect(const std::string &address);
+void set_timeout(const int &fd, const long &seconds);
+
+bool write_all(const int &fd, const std::string &data);
+bool read_exact(const int &fd, std::string &data, const std::size_t &size);
+bool read_line(const int &fd, std::string &line);
+
+} // namespace tpm::net
+
+#endif /* end of include guard: NET_HPP_H3LC8WQB */
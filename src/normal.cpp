@@ -0,0 +1,63 @@
+#include "normal.hpp"
+
+#include <limits>
+
+#include <CL/sycl.hpp>
+
+#include "dual.hpp"
+#include "render.hpp"
+#include "sdf.hpp"
+
+constexpr float normal_h = 1e-4f;
+
+template <typename Sdfs>
+tpm::Dual tpm::eval_sdf_grad(const cl::sycl::float3 &p, const std::size_t &id,
+                             const Sdfs &sdf) {
+  switch (sdf[id].type) {
+  case SPHERE:
+    return Dual(sdf::sphere(p, sdf[id].args[0]),
+                sdf::sphere_grad(p, sdf[id].args[0]));
+  case BOX: {
+    cl::sycl::float3 b(sdf[id].args[0], sdf[id].args[1], sdf[id].args[2]);
+    return Dual(sdf::box(p, b), sdf::box_grad(p, b));
+  }
+  case TRANSLATE:
+    return eval_sdf_grad(
+        sdf::op_translate(p, cl::sycl::float3(sdf[id].args[0], sdf[id].args[1],
+                                              sdf[id].args[2])),
+        sdf[id].a, sdf);
+  case UNION:
+    return min(eval_sdf_grad(p, sdf[id].a, sdf),
+               eval_sdf_grad(p, sdf[id].b, sdf));
+  default: {
+    std::size_t mat = std::numeric_limits<std::size_t>::max();
+    return eval_sdf(dual_variable(p), id, sdf, mat);
+  }
+  }
+}
+
+template <typename Sdfs>
+cl::sycl::float3 tpm::normal_tetrahedron(const cl::sycl::float3 &p,
+                                         const Sdfs &sdfs) {
+  std::size_t mat = std::numeric_limits<std::size_t>::max();
+  cl::sycl::float3 a(1.0f, -1.0f, -1.0f), b(-1.0f, -1.0f, 1.0f),
+      c(-1.0f, 1.0f, -1.0f), d(1.0f, 1.0f, 1.0f);
+  return cl::sycl::normalize(a * eval_sdf(p + (a * normal_h), 0, sdfs, mat) +
+                             b * eval_sdf(p + (b * normal_h), 0, sdfs, mat) +
+                             c * eval_sdf(p + (c * normal_h), 0, sdfs, mat) +
+                             d * eval_sdf(p + (d * normal_h), 0, sdfs, mat));
+}
+
+template <typename Sdfs>
+cl::sycl::float3 tpm::normal(const cl::sycl::float3 &p, const Sdfs &sdfs) {
+  Dual t = eval_sdf_grad(p, 0, sdfs);
+  if (cl::sycl::dot(t.grad, t.grad) > 0.0f)
+    return cl::sycl::normalize(t.grad);
+  return normal_tetrahedron(p, sdfs);
+}
+
+template cl::sycl::float3 tpm::normal(
+    const cl::sycl::float3 &p,
+    const cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> &sdfs);
+template cl::sycl::float3 tpm::normal(const cl::sycl::float3 &p,
+                                      const HostView<Sdf> &sdfs);
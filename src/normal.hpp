@@ -0,0 +1,26 @@
+#ifndef NORMAL_HPP_K3QX7VNE
+#define NORMAL_HPP_K3QX7VNE
+
+#include <cstdint>
+
+#include <CL/sycl.hpp>
+
+#include "dual.hpp"
+#include "scene.hpp"
+
+namespace tpm {
+
+// Sphere and box leaves, and the translate and union nodes above them, use
+// their analytic gradients; any other subtree is evaluated with dual numbers.
+template <typename Sdfs>
+Dual eval_sdf_grad(const cl::sycl::float3 &p, const std::size_t &id,
+                   const Sdfs &sdf);
+template <typename Sdfs>
+cl::sycl::float3 normal_tetrahedron(const cl::sycl::float3 &p,
+                                    const Sdfs &sdfs);
+template <typename Sdfs>
+cl::sycl::float3 normal(const cl::sycl::float3 &p, const Sdfs &sdfs);
+
+} // namespace tpm
+
+#endif /* end of include guard: NORMAL_HPP_K3QX7VNE */
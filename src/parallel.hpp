@@ -0,0 +1,48 @@
+#ifndef PARALLEL_HPP_M1WQ9DKX
+#define PARALLEL_HPP_M1WQ9DKX
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tpm {
+
+// Runs f over [0, count) on up to thread_count threads, each of which calls
+// init before taking work, e.g. to pin itself to a set of cpus.
+template <typename I, typename F>
+inline void host_parallel_for(const std::size_t &count,
+                              const std::size_t &thread_count, I &&init,
+                              F &&f) {
+  std::size_t threads = std::min(count, thread_count);
+  if (threads <= 1) {
+    init();
+    for (std::size_t i = 0; i < count; ++i)
+      f(i);
+    return;
+  }
+  std::atomic<std::size_t> next(0);
+  std::vector<std::thread> workers;
+  for (std::size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([&]() {
+      init();
+      for (std::size_t id = next++; id < count; id = next++)
+        f(id);
+    });
+  }
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+template <typename F>
+inline void host_parallel_for(const std::size_t &count, F &&f) {
+  host_parallel_for(
+      count, std::max(1u, std::thread::hardware_concurrency()), []() {},
+      std::forward<F>(f));
+}
+
+} // namespace tpm
+
+#endif /* end of include guard: PARALLEL_HPP_M1WQ9DKX */
@@ -0,0 +1,127 @@
+#ifndef PIXEL_HPP_H7DX2KQN
+#define PIXEL_HPP_H7DX2KQN
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <CL/sycl.hpp>
+
+#include "half.hpp"
+#include "scene.hpp"
+
+namespace tpm {
+
+inline std::size_t pixel_words(const PixelFormat &format) {
+  switch (format) {
+  case RGBA16F:
+    return 2;
+  case RGB9E5:
+    return 1;
+  case RGB32F:
+  default:
+    return 3;
+  }
+}
+
+inline float pow2(const int &e) {
+  std::uint32_t bits = static_cast<std::uint32_t>(e + 127) << 23;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+inline std::uint32_t rgb9e5_encode(const cl::sycl::float3 &v) {
+  constexpr float max_value = 65408.0f;
+  float c[3];
+  for (int i = 0; i < 3; ++i)
+    c[i] = v[i] > 0.0f ? (v[i] < max_value ? v[i] : max_value) : 0.0f;
+  float m = c[0] > c[1] ? (c[0] > c[2] ? c[0] : c[2])
+                        : (c[1] > c[2] ? c[1] : c[2]);
+  std::uint32_t bits;
+  std::memcpy(&bits, &m, sizeof(bits));
+  int e = static_cast<int>((bits >> 23) & 0xFFu) - 127;
+  int exp = (e < -16 ? -16 : e) + 16;
+  float scale = pow2(exp - 24);
+  if (static_cast<std::uint32_t>(m / scale + 0.5f) == 512) {
+    ++exp;
+    scale *= 2.0f;
+  }
+  std::uint32_t out = static_cast<std::uint32_t>(exp) << 27;
+  for (int i = 0; i < 3; ++i)
+    out |= static_cast<std::uint32_t>(c[i] / scale + 0.5f) << (9 * i);
+  return out;
+}
+
+inline cl::sycl::float3 rgb9e5_decode(const std::uint32_t &w) {
+  float scale = pow2(static_cast<int>(w >> 27) - 24);
+  return cl::sycl::float3(static_cast<float>(w & 0x1FFu) * scale,
+                          static_cast<float>((w >> 9) & 0x1FFu) * scale,
+                          static_cast<float>((w >> 18) & 0x1FFu) * scale);
+}
+
+template <typename W>
+inline void store_pixel(const PixelFormat &format, W &words,
+                        const std::size_t &idx, const cl::sycl::float3 &v) {
+  switch (format) {
+  case RGBA16F:
+    words[2 * idx] = static_cast<std::uint32_t>(float_to_half(v[0])) |
+                     static_cast<std::uint32_t>(float_to_half(v[1])) << 16;
+    words[2 * idx + 1] = static_cast<std::uint32_t>(float_to_half(v[2])) |
+                         static_cast<std::uint32_t>(0x3C00u) << 16;
+    break;
+  case RGB9E5:
+    words[idx] = rgb9e5_encode(v);
+    break;
+  case RGB32F:
+  default:
+    for (int c = 0; c < 3; ++c) {
+      std::uint32_t bits;
+      float f = v[c];
+      std::memcpy(&bits, &f, sizeof(bits));
+      words[3 * idx + c] = bits;
+    }
+    break;
+  }
+}
+
+template <typename W>
+inline cl::sycl::float3 load_pixel(const PixelFormat &format, const W &words,
+                                   const std::size_t &idx) {
+  switch (format) {
+  case RGBA16F: {
+    std::uint32_t rg = words[2 * idx], ba = words[2 * idx + 1];
+    return cl::sycl::float3(
+        half_to_float(static_cast<std::uint16_t>(rg & 0xFFFFu)),
+        half_to_float(static_cast<std::uint16_t>(rg >> 16)),
+        half_to_float(static_cast<std::uint16_t>(ba & 0xFFFFu)));
+  }
+  case RGB9E5:
+    return rgb9e5_decode(words[idx]);
+  case RGB32F:
+  default: {
+    float f[3];
+    for (int c = 0; c < 3; ++c) {
+      std::uint32_t bits = words[3 * idx + c];
+      std::memcpy(&f[c], &bits, sizeof(bits));
+    }
+    return cl::sycl::float3(f[0], f[1], f[2]);
+  }
+  }
+}
+
+struct PixelView {
+  inline cl::sycl::float3 operator[](const std::size_t &idx) const {
+    return load_pixel(format, data, idx);
+  }
+  inline PixelView operator+(const std::size_t &offset) const {
+    return PixelView{data + offset * pixel_words(format), format};
+  }
+
+  const std::uint32_t *data;
+  PixelFormat format;
+};
+
+} // namespace tpm
+
+#endif /* end of include guard: PIXEL_HPP_H7DX2KQN */
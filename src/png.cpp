@@ -0,0 +1,252 @@
+#include "png.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include "log.hpp"
+#include "parallel.hpp"
+#include "prof.hpp"
+
+constexpr std::size_t chunk_bytes = 256 * 1024;
+constexpr std::size_t window_bytes = 32 * 1024;
+
+static void put_u32(std::vector<std::uint8_t> &out, const std::uint32_t &v) {
+  out.push_back(static_cast<std::uint8_t>(v >> 24));
+  out.push_back(static_cast<std::uint8_t>(v >> 16));
+  out.push_back(static_cast<std::uint8_t>(v >> 8));
+  out.push_back(static_cast<std::uint8_t>(v));
+}
+
+static void write_chunk(std::ofstream &file, const char *type,
+                        const std::uint8_t *data, const std::size_t &size) {
+  std::vector<std::uint8_t> head;
+  put_u32(head, static_cast<std::uint32_t>(size));
+  head.insert(head.end(), type, type + 4);
+  uLong crc = crc32(0L, head.data() + 4, 4);
+  if (size != 0)
+    crc = crc32(crc, data, static_cast<uInt>(size));
+  std::vector<std::uint8_t> tail;
+  put_u32(tail, static_cast<std::uint32_t>(crc));
+  file.write(reinterpret_cast<const char *>(head.data()),
+             static_cast<std::streamsize>(head.size()));
+  file.write(reinterpret_cast<const char *>(data),
+             static_cast<std::streamsize>(size));
+  file.write(reinterpret_cast<const char *>(tail.data()),
+             static_cast<std::streamsize>(tail.size()));
+}
+
+static inline std::uint8_t paeth(const int &a, const int &b, const int &c) {
+  int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b),
+      pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return static_cast<std::uint8_t>(a);
+  return static_cast<std::uint8_t>(pb <= pc ? b : c);
+}
+
+void tpm::png::filter_rows(const std::uint8_t *data,
+                           const std::uint8_t *prior,
+                           const std::uint32_t &width,
+                           const std::uint32_t &rows, std::uint8_t *out) {
+  std::size_t stride = static_cast<std::size_t>(width) * 3;
+  std::vector<std::uint8_t> zero(stride, 0), candidate(stride);
+  for (std::uint32_t y = 0; y < rows; ++y) {
+    const std::uint8_t *row = data + y * stride;
+    const std::uint8_t *up =
+        y != 0 ? row - stride : (prior != nullptr ? prior : zero.data());
+    std::uint8_t *dst = out + y * (stride + 1);
+    std::uint64_t best = ~std::uint64_t(0);
+    for (std::uint8_t filter = 0; filter < 5; ++filter) {
+      std::uint64_t cost = 0;
+      for (std::size_t i = 0; i < stride; ++i) {
+        int a = i >= 3 ? row[i - 3] : 0, b = up[i],
+            c = i >= 3 ? up[i - 3] : 0;
+        std::uint8_t v = row[i];
+        switch (filter) {
+        case 1:
+          v = static_cast<std::uint8_t>(v - a);
+          break;
+        case 2:
+          v = static_cast<std::uint8_t>(v - b);
+          break;
+        case 3:
+          v = static_cast<std::uint8_t>(v - ((a + b) >> 1));
+          break;
+        case 4:
+          v = static_cast<std::uint8_t>(v - paeth(a, b, c));
+          break;
+        default:
+          break;
+        }
+        candidate[i] = v;
+        cost += static_cast<std::uint64_t>(
+            std::abs(static_cast<int>(static_cast<std::int8_t>(v))));
+      }
+      if (cost < best) {
+        best = cost;
+        dst[0] = filter;
+        std::copy(candidate.begin(), candidate.end(), dst + 1);
+      }
+    }
+  }
+}
+
+std::vector<std::uint8_t>
+tpm::png::deflate_chunk(const std::uint8_t *dict, const std::size_t &dict_size,
+                        const std::uint8_t *data, const std::size_t &size,
+                        const int &level, const bool &last) {
+  z_stream strm{};
+  std::vector<std::uint8_t> out;
+  if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) !=
+      Z_OK)
+    return out;
+  if (dict_size != 0)
+    deflateSetDictionary(&strm, dict, static_cast<uInt>(dict_size));
+
+  out.resize(deflateBound(&strm, static_cast<uLong>(size)) + 16);
+  strm.next_in = const_cast<Bytef *>(data);
+  strm.avail_in = static_cast<uInt>(size);
+  strm.next_out = out.data();
+  strm.avail_out = static_cast<uInt>(out.size());
+  int ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+  if (ret == Z_STREAM_END || ret == Z_OK)
+    out.resize(strm.total_out);
+  else
+    out.clear();
+  deflateEnd(&strm);
+  return out;
+}
+
+bool tpm::png::Stream::open(const std::filesystem::path &path,
+                            const std::uint32_t &img_width,
+                            const std::uint32_t &img_height,
+                            const int &zip_level) {
+  PFUNC(path.string(), img_width, img_height, zip_level);
+  if (img_width == 0 || img_height == 0)
+    return false;
+  width = img_width;
+  height = img_height;
+  level = zip_level;
+  rows = 0;
+  adler = adler32(0L, Z_NULL, 0);
+  window.clear();
+  prior.clear();
+
+  file.open(path, std::ios::binary);
+  if (!file)
+    return false;
+  const std::uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A,
+                                     '\n'};
+  file.write(reinterpret_cast<const char *>(signature), 8);
+
+  std::vector<std::uint8_t> ihdr;
+  put_u32(ihdr, width);
+  put_u32(ihdr, height);
+  ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+  write_chunk(file, "IHDR", ihdr.data(), ihdr.size());
+
+  std::uint8_t flevel =
+      level == Z_DEFAULT_COMPRESSION
+          ? 2
+          : (level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3)));
+  std::uint8_t cmf = 0x78, flg = static_cast<std::uint8_t>(flevel << 6);
+  flg = static_cast<std::uint8_t>(flg + (31 - ((cmf * 256 + flg) % 31)));
+  std::uint8_t header[2] = {cmf, flg};
+  write_chunk(file, "IDAT", header, 2);
+  return static_cast<bool>(file);
+}
+
+bool tpm::png::Stream::write_rows(const std::uint8_t *data,
+                                  const std::uint32_t &count) {
+  PFUNC(rows, count);
+  if (count == 0 || rows + count > height)
+    return false;
+  std::size_t row_bytes = static_cast<std::size_t>(width) * 3,
+              stride = row_bytes + 1;
+  std::uint32_t rows_per_chunk = static_cast<std::uint32_t>(
+      std::max<std::size_t>(1, chunk_bytes / stride));
+  std::uint32_t chunk_count = (count + rows_per_chunk - 1) / rows_per_chunk;
+  bool finish = rows + count == height;
+
+  std::vector<std::uint8_t> filtered(window);
+  std::size_t base = filtered.size();
+  filtered.resize(base + stride * count);
+  host_parallel_for(chunk_count, [&](const std::size_t &i) {
+    std::uint32_t y0 = static_cast<std::uint32_t>(i) * rows_per_chunk,
+                  y1 = std::min(count, y0 + rows_per_chunk);
+    const std::uint8_t *up =
+        y0 != 0 ? data + (y0 - 1) * row_bytes
+                : (prior.empty() ? nullptr : prior.data());
+    filter_rows(data + y0 * row_bytes, up, width, y1 - y0,
+                filtered.data() + base + y0 * stride);
+  });
+
+  std::vector<std::vector<std::uint8_t>> chunks(chunk_count);
+  std::vector<uLong> adlers(chunk_count);
+  std::atomic<bool> failed(false);
+  auto chunk_range = [&](const std::size_t &i) {
+    return std::make_pair(
+        base + i * rows_per_chunk * stride,
+        std::min(filtered.size(), base + (i + 1) * rows_per_chunk * stride));
+  };
+  host_parallel_for(chunk_count, [&](const std::size_t &i) {
+    auto [begin, end] = chunk_range(i);
+    std::size_t dict = std::min(begin, window_bytes);
+    chunks[i] = deflate_chunk(filtered.data() + begin - dict, dict,
+                              filtered.data() + begin, end - begin, level,
+                              finish && i + 1 == chunk_count);
+    adlers[i] = adler32(adler32(0L, Z_NULL, 0), filtered.data() + begin,
+                        static_cast<uInt>(end - begin));
+    if (chunks[i].empty())
+      failed = true;
+  });
+  if (failed) {
+    LWARN("Failed to deflate PNG rows {}-{}", rows, rows + count);
+    return false;
+  }
+
+  for (std::uint32_t i = 0; i < chunk_count; ++i) {
+    auto [begin, end] = chunk_range(i);
+    adler = adler32_combine(adler, adlers[i],
+                            static_cast<z_off_t>(end - begin));
+    write_chunk(file, "IDAT", chunks[i].data(), chunks[i].size());
+  }
+
+  std::size_t keep = std::min(filtered.size(), window_bytes);
+  window.assign(filtered.end() - static_cast<std::ptrdiff_t>(keep),
+                filtered.end());
+  prior.assign(data + (count - 1) * row_bytes, data + count * row_bytes);
+  rows += count;
+  return static_cast<bool>(file);
+}
+
+bool tpm::png::Stream::close() {
+  PFUNC();
+  if (rows != height) {
+    LWARN("PNG stream closed after {} of {} rows", rows, height);
+    file.close();
+    return false;
+  }
+  std::vector<std::uint8_t> trailer;
+  put_u32(trailer, static_cast<std::uint32_t>(adler));
+  write_chunk(file, "IDAT", trailer.data(), trailer.size());
+  write_chunk(file, "IEND", nullptr, 0);
+  file.close();
+  return !file.fail();
+}
+
+bool tpm::png::write(const std::filesystem::path &path,
+                     const std::uint32_t &width, const std::uint32_t &height,
+                     const std::uint8_t *data, const int &level) {
+  PFUNC(path.string(), width, height, level);
+  Stream stream;
+  return stream.open(path, width, height, level) &&
+         stream.write_rows(data, height) && stream.close();
+}
@@ -0,0 +1,39 @@
+#ifndef PNG_HPP_T2NF6WUC
+#define PNG_HPP_T2NF6WUC
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace tpm::png {
+
+void filter_rows(const std::uint8_t *data, const std::uint8_t *prior,
+                 const std::uint32_t &width, const std::uint32_t &rows,
+                 std::uint8_t *out);
+std::vector<std::uint8_t> deflate_chunk(const std::uint8_t *dict,
+                                        const std::size_t &dict_size,
+                                        const std::uint8_t *data,
+                                        const std::size_t &size,
+                                        const int &level, const bool &last);
+
+struct Stream {
+  bool open(const std::filesystem::path &path, const std::uint32_t &width,
+            const std::uint32_t &height, const int &level);
+  bool write_rows(const std::uint8_t *data, const std::uint32_t &count);
+  bool close();
+
+  std::ofstream file;
+  std::uint32_t width = 0, height = 0, rows = 0;
+  int level = 6;
+  unsigned long adler = 1;
+  std::vector<std::uint8_t> window, prior;
+};
+
+bool write(const std::filesystem::path &path, const std::uint32_t &width,
+           const std::uint32_t &height, const std::uint8_t *data,
+           const int &level);
+
+} // namespace tpm::png
+
+#endif /* end of include guard: PNG_HPP_T2NF6WUC */
@@ -0,0 +1,110 @@
+#include "pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <CL/sycl.hpp>
+
+#include "exit_code.hpp"
+#include "log.hpp"
+#include "prof.hpp"
+#include "render.hpp"
+#include "scene.hpp"
+#include "video.hpp"
+
+tpm::WritePool::WritePool(std::size_t worker_count, std::size_t queue_depth)
+    : depth(std::max<std::size_t>(1, queue_depth)), active(0), stopping(false),
+      status(OK) {
+  for (std::size_t i = 0; i < std::max<std::size_t>(1, worker_count); ++i) {
+    workers.emplace_back([this]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true) {
+        not_empty.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+          return;
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        ++active;
+        lock.unlock();
+        not_full.notify_one();
+
+        ExitCode ret;
+        {
+          PSCOPE("WriteJob");
+          ret = job(queue);
+        }
+
+        lock.lock();
+        --active;
+        if (status == OK)
+          status = ret;
+        if (jobs.empty() && active == 0)
+          idle.notify_all();
+      }
+    });
+  }
+}
+
+tpm::WritePool::~WritePool() {
+  close();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  not_empty.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+tpm::ExitCode tpm::WritePool::submit(Job job) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (jobs.size() >= depth) {
+    PSCOPE("WriteBackpressure", jobs.size());
+    LINFO("Write queue full ({} pending), waiting for encoder", jobs.size());
+    not_full.wait(lock, [this]() { return jobs.size() < depth; });
+  }
+  jobs.push_back(std::move(job));
+  ExitCode ret = status;
+  lock.unlock();
+  not_empty.notify_one();
+  return ret;
+}
+
+tpm::ExitCode tpm::WritePool::drain() {
+  PFUNC();
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this]() { return jobs.empty() && active == 0; });
+  ExitCode ret = status;
+  status = OK;
+  return ret;
+}
+
+tpm::ExitCode tpm::WritePool::close() {
+  PFUNC();
+  ExitCode ret = drain();
+  for (auto &[path, writer] : videos) {
+    if (writer && !writer->close() && ret == OK)
+      ret = IMG_WRITE_ERR;
+  }
+  videos.clear();
+  return ret;
+}
+
+std::shared_ptr<tpm::video::Writer>
+tpm::WritePool::video(const OutputSpec &spec, const cl::sycl::uint3 &size) {
+  auto it = videos.find(spec.path);
+  if (it != videos.end())
+    return it->second;
+  std::shared_ptr<video::Writer> writer = std::make_shared<video::Writer>();
+  if (make_output_dir(spec.path) != OK ||
+      !writer->open(spec.path, size[0], size[1], spec.fps, spec.encoder)) {
+    LWARN("Failed to open video output \"{}\"", spec.path);
+    writer = nullptr;
+  }
+  videos.emplace(spec.path, writer);
+  return writer;
+}
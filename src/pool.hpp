@@ -0,0 +1,49 @@
+#ifndef POOL_HPP_W7RKD2QF
+#define POOL_HPP_W7RKD2QF
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "exit_code.hpp"
+#include "scene.hpp"
+#include "video.hpp"
+
+namespace tpm {
+
+struct WritePool {
+  using Job = std::function<ExitCode(cl::sycl::queue &)>;
+
+  WritePool(std::size_t worker_count = 1, std::size_t queue_depth = 2);
+  ~WritePool();
+
+  ExitCode submit(Job job);
+  ExitCode drain();
+  ExitCode close();
+  std::shared_ptr<video::Writer> video(const OutputSpec &spec,
+                                       const cl::sycl::uint3 &size);
+
+  cl::sycl::queue queue;
+  std::size_t depth;
+  std::deque<Job> jobs;
+  std::size_t active;
+  bool stopping;
+  ExitCode status;
+  std::mutex mutex;
+  std::condition_variable not_empty, not_full, idle;
+  std::vector<std::thread> workers;
+  std::map<std::string, std::shared_ptr<video::Writer>> videos;
+};
+
+} // namespace tpm
+
+#endif /* end of include guard: POOL_HPP_W7RKD2QF */
@@ -0,0 +1,295 @@
+#include "prune.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "render.hpp"
+#include "sdf.hpp"
+
+constexpr std::size_t pruned = std::numeric_limits<std::size_t>::max();
+constexpr std::size_t prune_slabs = 32;
+constexpr float prune_near = 0.5f;
+constexpr float keep = std::numeric_limits<float>::infinity();
+
+std::vector<tpm::Interval3> tpm::tile_bounds(const cl::sycl::uint3 &size,
+                                             const cl::sycl::uint4 &tile,
+                                             const float &max_t) {
+  float w = static_cast<float>(size[0]), h = static_cast<float>(size[1]);
+  Interval3 dir(Interval((static_cast<float>(tile[0]) - 0.5f) / w - 0.5f,
+                         (static_cast<float>(tile[2]) - 0.5f) / w - 0.5f),
+                Interval((static_cast<float>(tile[1]) - 0.5f) / h - 0.5f,
+                         (static_cast<float>(tile[3]) - 0.5f) / h - 0.5f),
+                Interval(1.0f));
+  float ratio = std::pow(max_t / prune_near,
+                         1.0f / static_cast<float>(prune_slabs - 1));
+  std::vector<Interval3> regions;
+  regions.push_back(Interval(0.0f, prune_near) * dir);
+  for (float t = prune_near; t < max_t; t *= ratio)
+    regions.push_back(Interval(t, std::min(t * ratio, max_t)) * dir);
+  return regions;
+}
+
+std::size_t tpm::prune_sdf(const std::vector<Interval3> &regions,
+                           const std::size_t &id, const float &margin,
+                           const std::vector<Sdf> &sdfs, std::vector<Sdf> &out,
+                           std::vector<Interval> &t) {
+  const Sdf &node = sdfs[id];
+  cl::sycl::float4 args = node.args;
+  cl::sycl::float3 xyz(args[0], args[1], args[2]);
+  std::size_t mark = out.size(), a = pruned, b = pruned;
+  std::vector<Interval3> child;
+  std::vector<Interval> ta, tb;
+  t.resize(regions.size());
+  switch (node.type) {
+  case SPHERE:
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::sphere(regions[i], args[0]);
+    break;
+  case BOX:
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::box(regions[i], xyz);
+    break;
+  case ROUND_BOX:
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::round_box(regions[i], xyz, args[3]);
+    break;
+  case TORUS:
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::torus(regions[i], args[0], args[1]);
+    break;
+  case CAPSULE:
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::capsule(regions[i], args[0], args[1]);
+    break;
+  case CYLINDER:
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::cylinder(regions[i], args[0], args[1]);
+    break;
+  case CONE:
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::cone(regions[i], args[0], args[1], args[2]);
+    break;
+  case PLANE:
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::plane(regions[i], xyz, args[3]);
+    break;
+  case ELLIPSOID:
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::ellipsoid(regions[i], xyz);
+    break;
+  case TRANSLATE:
+    for (const Interval3 &region : regions)
+      child.push_back(sdf::op_translate(region, xyz));
+    a = prune_sdf(child, node.a, margin, sdfs, out, t);
+    break;
+  case ROTATE:
+    for (const Interval3 &region : regions)
+      child.push_back(sdf::op_rotate(region, args));
+    a = prune_sdf(child, node.a, margin, sdfs, out, t);
+    break;
+  case SCALE:
+    for (const Interval3 &region : regions)
+      child.push_back(sdf::op_scale(region, args[0]));
+    a = prune_sdf(child, node.a, margin / args[0], sdfs, out, ta);
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = ta[i] * args[0];
+    break;
+  case TWIST:
+    for (const Interval3 &region : regions)
+      child.push_back(sdf::op_twist(region, args[0]));
+    a = prune_sdf(child, node.a, margin, sdfs, out, t);
+    break;
+  case BEND:
+    for (const Interval3 &region : regions)
+      child.push_back(sdf::op_bend(region, args[0]));
+    a = prune_sdf(child, node.a, margin, sdfs, out, t);
+    break;
+  case ROUND:
+    a = prune_sdf(regions, node.a, margin + args[0], sdfs, out, ta);
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::op_round(ta[i], args[0]);
+    break;
+  case ONION:
+    a = prune_sdf(regions, node.a, margin + args[0], sdfs, out, ta);
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::op_onion(ta[i], args[0]);
+    break;
+  case UNION:
+    a = prune_sdf(regions, node.a, margin, sdfs, out, ta);
+    b = prune_sdf(regions, node.b, margin, sdfs, out, tb);
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::op_union(ta[i], tb[i]);
+    break;
+  case INTERSECTION:
+    a = prune_sdf(regions, node.a, margin, sdfs, out, ta);
+    b = prune_sdf(regions, node.b, margin, sdfs, out, tb);
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::op_intersection(ta[i], tb[i]);
+    break;
+  case SUBTRACTION:
+    a = prune_sdf(regions, node.a, margin, sdfs, out, ta);
+    b = prune_sdf(regions, node.b, keep, sdfs, out, tb);
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::op_subtraction(ta[i], tb[i]);
+    break;
+  case SMOOTH_UNION:
+    a = prune_sdf(regions, node.a, margin + 2.0f * args[0], sdfs, out, ta);
+    b = prune_sdf(regions, node.b, margin + 2.0f * args[0], sdfs, out, tb);
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::op_smooth_union(ta[i], tb[i], args[0]);
+    break;
+  case SMOOTH_SUBTRACTION:
+    a = prune_sdf(regions, node.a, keep, sdfs, out, ta);
+    b = prune_sdf(regions, node.b, keep, sdfs, out, tb);
+    for (std::size_t i = 0; i < regions.size(); ++i)
+      t[i] = sdf::op_smooth_subtraction(ta[i], tb[i], args[0]);
+    break;
+  }
+
+  bool empty = true;
+  for (const Interval &ti : t)
+    empty = empty && ti.lo > margin;
+  switch (node.type) {
+  case UNION:
+  case SMOOTH_UNION:
+    empty = empty || (a == pruned && b == pruned);
+    break;
+  case INTERSECTION:
+    empty = empty || a == pruned || b == pruned;
+    break;
+  case TRANSLATE:
+  case ROTATE:
+  case SCALE:
+  case TWIST:
+  case BEND:
+  case ROUND:
+  case ONION:
+  case SUBTRACTION:
+    empty = empty || a == pruned;
+    break;
+  case SPHERE:
+  case BOX:
+  case ROUND_BOX:
+  case TORUS:
+  case CAPSULE:
+  case CYLINDER:
+  case CONE:
+  case PLANE:
+  case ELLIPSOID:
+  case SMOOTH_SUBTRACTION:
+    break;
+  }
+  if (empty) {
+    out.erase(out.begin() + static_cast<std::ptrdiff_t>(mark), out.end());
+    return pruned;
+  }
+  if ((node.type == UNION || node.type == SMOOTH_UNION) &&
+      (a == pruned || b == pruned))
+    return a == pruned ? b : a;
+
+  out.push_back(node);
+  out.back().a = a;
+  out.back().b = b;
+  return out.size() - 1;
+}
+
+std::size_t tpm::prune_tile(const cl::sycl::uint3 &size,
+                            const cl::sycl::uint2 &id, const float &max_t,
+                            const std::vector<Sdf> &sdfs,
+                            const std::size_t &offset, std::vector<Sdf> &out) {
+  out.clear();
+  if (sdfs.empty())
+    return pruned;
+  std::vector<Interval> t;
+  std::size_t root = prune_sdf(
+      tile_bounds(size, Image::tile(size, id), max_t), 0, 0.0f, sdfs, out, t);
+  if (root == pruned)
+    return pruned;
+  if (out.size() == sdfs.size()) {
+    out.clear();
+    return 0;
+  }
+  for (Sdf &node : out) {
+    node.a = node.a == pruned ? pruned : node.a + offset;
+    node.b = node.b == pruned ? pruned : node.b + offset;
+  }
+  return root + offset;
+}
+
+std::vector<std::size_t> tpm::sdf_parents(const std::vector<Sdf> &sdfs) {
+  std::vector<std::size_t> parents(sdfs.size(), pruned);
+  for (std::size_t i = 0; i < sdfs.size(); ++i) {
+    if (sdfs[i].a < sdfs.size())
+      parents[sdfs[i].a] = i;
+    if (sdfs[i].b < sdfs.size())
+      parents[sdfs[i].b] = i;
+  }
+  return parents;
+}
+
+bool tpm::prune_reaches(const std::vector<Interval3> &regions,
+                        const std::size_t &id,
+                        const std::vector<std::size_t> &parents,
+                        const std::vector<Sdf> &sdfs) {
+  std::vector<std::size_t> path;
+  for (std::size_t i = id; i != pruned; i = parents[i])
+    path.push_back(i);
+  std::vector<Interval3> bounds = regions;
+  float margin = 0.0f;
+  // Walk down from the root narrowing the regions and widening the margin
+  // exactly as prune_sdf does on its way to this node. A node pruned from a
+  // tile under both its old and new args leaves that tile's tree unchanged,
+  // except under a smooth union whose interval blend is looser than its
+  // children, so those are always treated as reaching.
+  for (std::size_t i = path.size() - 1; i > 0 && margin != keep; --i) {
+    const Sdf &node = sdfs[path[i]];
+    cl::sycl::float4 args = node.args;
+    cl::sycl::float3 xyz(args[0], args[1], args[2]);
+    bool second = node.b == path[i - 1];
+    switch (node.type) {
+    case TRANSLATE:
+      for (Interval3 &region : bounds)
+        region = sdf::op_translate(region, xyz);
+      break;
+    case ROTATE:
+      for (Interval3 &region : bounds)
+        region = sdf::op_rotate(region, args);
+      break;
+    case SCALE:
+      for (Interval3 &region : bounds)
+        region = sdf::op_scale(region, args[0]);
+      margin /= args[0];
+      break;
+    case TWIST:
+      for (Interval3 &region : bounds)
+        region = sdf::op_twist(region, args[0]);
+      break;
+    case BEND:
+      for (Interval3 &region : bounds)
+        region = sdf::op_bend(region, args[0]);
+      break;
+    case ROUND:
+    case ONION:
+      margin += args[0];
+      break;
+    case SUBTRACTION:
+      margin = second ? keep : margin;
+      break;
+    case SMOOTH_UNION:
+    case SMOOTH_SUBTRACTION:
+      margin = keep;
+      break;
+    default:
+      break;
+    }
+  }
+  if (margin == keep)
+    return true;
+  std::vector<Sdf> out;
+  std::vector<Interval> t;
+  return prune_sdf(bounds, id, margin, sdfs, out, t) != pruned;
+}
@@ -0,0 +1,31 @@
+#ifndef PRUNE_HPP_V7RD1XSE
+#define PRUNE_HPP_V7RD1XSE
+
+#include <cstdint>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "interval.hpp"
+#include "scene.hpp"
+
+namespace tpm {
+
+std::vector<Interval3> tile_bounds(const cl::sycl::uint3 &size,
+                                   const cl::sycl::uint4 &tile,
+                                   const float &max_t);
+std::size_t prune_sdf(const std::vector<Interval3> &regions,
+                      const std::size_t &id, const float &margin,
+                      const std::vector<Sdf> &sdfs, std::vector<Sdf> &out,
+                      std::vector<Interval> &t);
+std::size_t prune_tile(const cl::sycl::uint3 &size, const cl::sycl::uint2 &id,
+                       const float &max_t, const std::vector<Sdf> &sdfs,
+                       const std::size_t &offset, std::vector<Sdf> &out);
+std::vector<std::size_t> sdf_parents(const std::vector<Sdf> &sdfs);
+bool prune_reaches(const std::vector<Interval3> &regions, const std::size_t &id,
+                   const std::vector<std::size_t> &parents,
+                   const std::vector<Sdf> &sdfs);
+
+} // namespace tpm
+
+#endif /* end of include guard: PRUNE_HPP_V7RD1XSE */
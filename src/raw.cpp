@@ -0,0 +1,44 @@
+#include "raw.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+#include "log.hpp"
+#include "prof.hpp"
+
+std::array<std::uint32_t, 4> tpm::raw::header(const Image &img) {
+  return {magic, img.size[0], img.size[1],
+          static_cast<std::uint32_t>(img.format)};
+}
+
+bool tpm::raw::map(const std::filesystem::path &path, Image &img) {
+  PFUNC(path.string(), img.size);
+  std::unique_ptr<MappedFile> mapping = std::make_unique<MappedFile>();
+  if (!mapping->open(path, header_bytes +
+                               img.word_count() * sizeof(std::uint32_t)))
+    return false;
+  std::array<std::uint32_t, 4> head = header(img);
+  std::memcpy(mapping->data, head.data(), header_bytes);
+  img.words = reinterpret_cast<std::uint32_t *>(mapping->data + header_bytes);
+  img.mapping = std::move(mapping);
+  img.buffer.clear();
+  img.buffer.shrink_to_fit();
+  return true;
+}
+
+bool tpm::raw::write(const std::filesystem::path &path, const Image &img) {
+  PFUNC(path.string(), img.size);
+  if (img.mapping)
+    return img.mapping->flush();
+  std::ofstream file(path, std::ios::binary);
+  std::array<std::uint32_t, 4> head = header(img);
+  file.write(reinterpret_cast<const char *>(head.data()), header_bytes);
+  file.write(reinterpret_cast<const char *>(img.data()),
+             static_cast<std::streamsize>(img.word_count() *
+                                          sizeof(std::uint32_t)));
+  return static_cast<bool>(file);
+}
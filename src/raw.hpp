@@ -0,0 +1,21 @@
+#ifndef RAW_HPP_K5ZP1WGD
+#define RAW_HPP_K5ZP1WGD
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+
+#include "render.hpp"
+
+namespace tpm::raw {
+
+constexpr std::uint32_t magic = 0x524d5054;
+constexpr std::size_t header_bytes = 16;
+
+std::array<std::uint32_t, 4> header(const Image &img);
+bool map(const std::filesystem::path &path, Image &img);
+bool write(const std::filesystem::path &path, const Image &img);
+
+} // namespace tpm::raw
+
+#endif /* end of include guard: RAW_HPP_K5ZP1WGD */
@@ -1,23 +1,49 @@
 #include "render.hpp"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
+#include <deque>
 #include <filesystem>
 #include <limits>
+#include <memory>
+#include <optional>
 #include <random>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <CL/sycl.hpp>
 #include <hipSYCL/sycl/handler.hpp>
 #include <hipSYCL/sycl/queue.hpp>
 
+#include "convert.hpp"
+#include "device.hpp"
+#include "exr.hpp"
 #include "log.hpp"
+#include "normal.hpp"
+#include "parallel.hpp"
+#include "png.hpp"
+#include "pool.hpp"
+#include "prune.hpp"
 #include "prof.hpp"
+#include "raw.hpp"
 #include "sdf.hpp"
 #include "stb_image_write.h"
+#include "stream.hpp"
+#include "video.hpp"
 
 constexpr float epsilon = std::numeric_limits<float>::epsilon() * 10.0f;
 constexpr float max_t = 100.0f;
 constexpr std::size_t sample_count = 2;
+constexpr float shadow_min_t = 1e-2f;
+constexpr std::size_t shadow_steps = 64;
+constexpr std::size_t ao_taps = 5;
+constexpr float ambient = 0.05f;
+constexpr std::size_t stream_depth = 2;
+constexpr std::uint32_t band_items = 4;
+constexpr std::size_t copy_gap = 16;
 
 namespace fmt {
 template <typename T, int N> struct formatter<cl::sycl::vec<T, N>> {
@@ -50,51 +76,141 @@ template <typename T, int N> struct formatter<cl::sycl::vec<T, N>> {
 
 } // namespace fmt
 
-float tpm::eval_sdf(
-    const cl::sycl::float3 &p, const std::size_t &id,
-    const cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> &sdf,
-    std::size_t &mat) {
+template <typename V, typename Sdfs>
+tpm::sdf::scalar_t<V> tpm::eval_sdf(const V &p, const std::size_t &id,
+                                    const Sdfs &sdf, std::size_t &mat) {
+  using T = sdf::scalar_t<V>;
   if (sdf[id].mat != std::numeric_limits<std::size_t>::max())
     mat = sdf[id].mat;
-  float t = std::numeric_limits<float>::infinity();
+  T t = T(std::numeric_limits<float>::infinity());
+  cl::sycl::float4 args = sdf[id].args;
+  cl::sycl::float3 xyz(args[0], args[1], args[2]);
   switch (sdf[id].type) {
   case SPHERE:
-    t = sdf::sphere(p, sdf[id].args[0]);
+    t = sdf::sphere(p, args[0]);
+    break;
+  case BOX:
+    t = sdf::box(p, xyz);
+    break;
+  case ROUND_BOX:
+    t = sdf::round_box(p, xyz, args[3]);
+    break;
+  case TORUS:
+    t = sdf::torus(p, args[0], args[1]);
+    break;
+  case CAPSULE:
+    t = sdf::capsule(p, args[0], args[1]);
+    break;
+  case CYLINDER:
+    t = sdf::cylinder(p, args[0], args[1]);
+    break;
+  case CONE:
+    t = sdf::cone(p, args[0], args[1], args[2]);
+    break;
+  case PLANE:
+    t = sdf::plane(p, xyz, args[3]);
+    break;
+  case ELLIPSOID:
+    t = sdf::ellipsoid(p, xyz);
     break;
   case TRANSLATE:
-    t = eval_sdf(
-        sdf::op_translate(p, cl::sycl::float3(sdf[id].args[0], sdf[id].args[1],
-                                              sdf[id].args[2])),
-        sdf[id].a, sdf, mat);
+    t = eval_sdf(sdf::op_translate(p, xyz), sdf[id].a, sdf, mat);
+    break;
+  case ROTATE:
+    t = eval_sdf(sdf::op_rotate(p, args), sdf[id].a, sdf, mat);
+    break;
+  case SCALE:
+    t = eval_sdf(sdf::op_scale(p, args[0]), sdf[id].a, sdf, mat) * args[0];
+    break;
+  case TWIST:
+    t = eval_sdf(sdf::op_twist(p, args[0]), sdf[id].a, sdf, mat);
+    break;
+  case BEND:
+    t = eval_sdf(sdf::op_bend(p, args[0]), sdf[id].a, sdf, mat);
+    break;
+  case ROUND:
+    t = sdf::op_round(eval_sdf(p, sdf[id].a, sdf, mat), args[0]);
+    break;
+  case ONION:
+    t = sdf::op_onion(eval_sdf(p, sdf[id].a, sdf, mat), args[0]);
     break;
   case UNION: {
     std::size_t ma = mat, mb = mat;
-    float a = eval_sdf(p, sdf[id].a, sdf, ma);
-    float b = eval_sdf(p, sdf[id].b, sdf, mb);
-    if (b > a) {
-      mat = ma;
-      t = a;
-    } else {
-      mat = mb;
-      t = b;
-    }
+    T a = eval_sdf(p, sdf[id].a, sdf, ma);
+    T b = eval_sdf(p, sdf[id].b, sdf, mb);
+    t = sdf::op_union(a, b);
+    mat = b > a ? ma : mb;
+    break;
+  }
+  case INTERSECTION: {
+    std::size_t ma = mat, mb = mat;
+    T a = eval_sdf(p, sdf[id].a, sdf, ma);
+    T b = eval_sdf(p, sdf[id].b, sdf, mb);
+    t = sdf::op_intersection(a, b);
+    mat = b > a ? mb : ma;
+    break;
+  }
+  case SUBTRACTION: {
+    std::size_t ma = mat, mb = mat;
+    T a = eval_sdf(p, sdf[id].a, sdf, ma);
+    T b = eval_sdf(p, sdf[id].b, sdf, mb);
+    t = sdf::op_subtraction(a, b);
+    mat = ma;
+    break;
+  }
+  case SMOOTH_UNION: {
+    std::size_t ma = mat, mb = mat;
+    T a = eval_sdf(p, sdf[id].a, sdf, ma);
+    T b = eval_sdf(p, sdf[id].b, sdf, mb);
+    t = sdf::op_smooth_union(a, b, args[0]);
+    mat = b > a ? ma : mb;
+    break;
+  }
+  case SMOOTH_SUBTRACTION: {
+    std::size_t ma = mat, mb = mat;
+    T a = eval_sdf(p, sdf[id].a, sdf, ma);
+    T b = eval_sdf(p, sdf[id].b, sdf, mb);
+    t = sdf::op_smooth_subtraction(a, b, args[0]);
+    mat = ma;
     break;
   }
   }
   return t;
 }
 
-cl::sycl::float3 tpm::ray_march(
-    const cl::sycl::float3 &p, const cl::sycl::float3 &d,
-    const cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> &sdfs,
-    const cl::sycl::accessor<Mat, 1, cl::sycl::access::mode::read> &mats) {
+template float tpm::eval_sdf(
+    const cl::sycl::float3 &p, const std::size_t &id,
+    const cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> &sdf,
+    std::size_t &mat);
+template tpm::Dual tpm::eval_sdf(
+    const Dual3 &p, const std::size_t &id,
+    const cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> &sdf,
+    std::size_t &mat);
+template float tpm::eval_sdf(const cl::sycl::float3 &p, const std::size_t &id,
+                             const HostView<Sdf> &sdf, std::size_t &mat);
+template tpm::Dual tpm::eval_sdf(const Dual3 &p, const std::size_t &id,
+                                 const HostView<Sdf> &sdf, std::size_t &mat);
+
+template <typename Sdfs, typename Mats>
+cl::sycl::float3 tpm::ray_march(const cl::sycl::float3 &p,
+                                const cl::sycl::float3 &d,
+                                const std::size_t &root, const Sdfs &sdfs,
+                                const Mats &mats, Aovs &aovs) {
+  aovs.depth = std::numeric_limits<float>::infinity();
+  aovs.material = -1.0f;
+  aovs.steps = 0.0f;
+  if (root == std::numeric_limits<std::size_t>::max())
+    return cl::sycl::float3(0.0, 0.0, 0.0);
   float t = 0.0f, delta_t = std::numeric_limits<float>::infinity();
   std::size_t mat = std::numeric_limits<std::size_t>::max();
   while (t < max_t && delta_t > epsilon) {
-    delta_t = eval_sdf(p + (t * d), 0, sdfs, mat);
+    delta_t = eval_sdf(p + (t * d), root, sdfs, mat);
     t += delta_t;
+    aovs.steps += 1.0f;
   }
   if (delta_t <= epsilon && mat != std::numeric_limits<std::size_t>::max()) {
+    aovs.depth = t * d[2];
+    aovs.material = static_cast<float>(mat);
     Mat it = mats[mat];
     switch (it.type) {
     case EMISSION:
@@ -110,11 +226,94 @@ cl::sycl::float3 tpm::ray_march(
   return cl::sycl::float3(0.0, 0.0, 0.0);
 }
 
-cl::sycl::float3 tpm::render_pixel(
-    const cl::sycl::uint4 &pixel, cl::sycl::uint4 &seed,
-    const cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> &sdfs,
-    const cl::sycl::accessor<Mat, 1, cl::sycl::access::mode::read> &mats) {
-  cl::sycl::float3 color(0.0, 0.0, 0.0);
+template <typename Sdfs>
+float tpm::soft_shadow(const cl::sycl::float3 &p, const cl::sycl::float3 &d,
+                       const float &min_t, const float &max_t, const float &k,
+                       const Sdfs &sdfs) {
+  std::size_t mat = std::numeric_limits<std::size_t>::max();
+  float res = 1.0f, t = min_t;
+  for (std::size_t i = 0; i < shadow_steps && t < max_t && res > epsilon;
+       ++i) {
+    float h = eval_sdf(p + (t * d), 0, sdfs, mat);
+    res = cl::sycl::min(res, k * h / t);
+    t += cl::sycl::clamp(h, shadow_min_t, 1.0f);
+  }
+  return cl::sycl::clamp(res, 0.0f, 1.0f);
+}
+
+template <typename Sdfs>
+float tpm::ambient_occlusion(const cl::sycl::float3 &p,
+                             const cl::sycl::float3 &n, const Sdfs &sdfs) {
+  std::size_t mat = std::numeric_limits<std::size_t>::max();
+  float occ = 0.0f, scale = 1.0f;
+  for (std::size_t i = 0; i < ao_taps; ++i) {
+    float h = 0.01f + 0.12f * static_cast<float>(i) /
+                          static_cast<float>(ao_taps - 1);
+    occ += (h - eval_sdf(p + (h * n), 0, sdfs, mat)) * scale;
+    scale *= 0.95f;
+  }
+  return cl::sycl::clamp(1.0f - 3.0f * occ, 0.0f, 1.0f);
+}
+
+template <typename Sdfs, typename Mats, typename Lights>
+cl::sycl::float3 tpm::preview_march(const cl::sycl::float3 &p,
+                                    const cl::sycl::float3 &d,
+                                    const std::size_t &root, const float &k,
+                                    const Sdfs &sdfs, const Mats &mats,
+                                    const Lights &lights, Aovs &aovs) {
+  aovs.depth = std::numeric_limits<float>::infinity();
+  aovs.material = -1.0f;
+  aovs.steps = 0.0f;
+  if (root == std::numeric_limits<std::size_t>::max())
+    return cl::sycl::float3(0.0, 0.0, 0.0);
+  cl::sycl::float3 dir = cl::sycl::normalize(d);
+  float t = 0.0f, delta_t = std::numeric_limits<float>::infinity();
+  std::size_t mat = std::numeric_limits<std::size_t>::max();
+  while (t < max_t && delta_t > epsilon) {
+    delta_t = eval_sdf(p + (t * dir), root, sdfs, mat);
+    t += delta_t;
+    aovs.steps += 1.0f;
+  }
+  if (delta_t > epsilon || mat == std::numeric_limits<std::size_t>::max())
+    return cl::sycl::float3(0.0, 0.0, 0.0);
+  aovs.depth = t * dir[2];
+  aovs.material = static_cast<float>(mat);
+
+  Mat it = mats[mat];
+  cl::sycl::float3 pos = p + (t * dir);
+  cl::sycl::float3 n = normal(pos, sdfs);
+  cl::sycl::float3 color =
+      it.color * (ambient * ambient_occlusion(pos, n, sdfs));
+  for (std::size_t i = 0; i < lights.get_count(); ++i) {
+    Light light = lights[i];
+    cl::sycl::float3 l = light.pos;
+    float dist = max_t, falloff = 1.0f;
+    if (light.type == POINT) {
+      l = light.pos - pos;
+      dist = cl::sycl::length(l);
+      l = l / dist;
+      falloff = 1.0f / (dist * dist);
+    }
+    float n_dot_l = cl::sycl::dot(n, l);
+    if (n_dot_l <= 0.0f)
+      continue;
+    float shadow = soft_shadow(pos + (n * shadow_min_t), l, shadow_min_t,
+                               dist, k, sdfs);
+    color += it.color * light.color * (n_dot_l * shadow * falloff);
+  }
+  if (it.type == EMISSION)
+    color += it.color * it.args[0];
+  return color;
+}
+
+template <typename Sdfs, typename Mats, typename Lights>
+tpm::Aovs tpm::render_pixel(const cl::sycl::uint4 &pixel,
+                            cl::sycl::uint4 &seed, const std::size_t &root,
+                            const RendererSpec &renderer,
+                            const std::uint32_t &aov_mask, const Sdfs &sdfs,
+                            const Mats &mats, const Lights &lights) {
+  Aovs aovs{cl::sycl::float3(0.0, 0.0, 0.0), cl::sycl::float3(0.0, 0.0, 0.0),
+            std::numeric_limits<float>::infinity(), -1.0f, 0.0f};
   cl::sycl::float3 pos(0.0, 0.0, 0.0);
   cl::sycl::float3 scaling(1.0 / static_cast<float>(pixel[2]),
                            1.0 / static_cast<float>(pixel[3]), 1.0);
@@ -126,80 +325,903 @@ cl::sycl::float3 tpm::render_pixel(
 
   for (std::size_t i = 0; i < sample_count; ++i) {
     cl::sycl::float3 jiggle(random(seed) - 0.5, random(seed) - 0.5, 0.0);
-    cl::sycl::float3 res = ray_march(pos, dir + (jiggle * scaling), sdfs, mats);
+    cl::sycl::float3 ray = dir + (jiggle * scaling);
+    cl::sycl::float3 res;
+    Aovs sample;
+    switch (renderer.integrator) {
+    case PREVIEW:
+      res = preview_march(pos, ray, root, renderer.shadow_k, sdfs, mats,
+                          lights, sample);
+      break;
+    case MARCH:
+    default:
+      res = ray_march(pos, ray, root, sdfs, mats, sample);
+      break;
+    }
 
-    color += res / sample_count;
+    aovs.beauty += res / sample_count;
+    aovs.steps += sample.steps / sample_count;
+    if (i == 0) {
+      aovs.depth = sample.depth;
+      aovs.material = sample.material;
+      if ((aov_mask & (1u << NORMAL)) && sample.material >= 0.0f)
+        aovs.normal = normal(pos + ray * sample.depth, sdfs);
+    }
   }
-  return color;
+  return aovs;
+}
+
+namespace tpm {
+
+struct Target {
+  Target(const OutputSpec &spec, const cl::sycl::uint3 &size)
+      : spec(spec), img(size, spec.format) {}
+
+  ExitCode open(cl::sycl::queue &queue) {
+    std::filesystem::path path = spec.path;
+    if (spec.stream && streamable(path)) {
+      ExitCode dir = make_output_dir(path);
+      if (dir != OK)
+        return dir;
+      std::unique_ptr<TileSink> sink = open_sink(queue, spec, img.size);
+      if (!sink)
+        return IMG_WRITE_ERR;
+      writer = std::make_unique<StreamWriter>(std::move(sink), stream_depth);
+      ring.resize(2 * stream_depth + 1);
+    } else if (path.extension() == ".raw") {
+      ExitCode dir = make_output_dir(path);
+      if (dir != OK)
+        return dir;
+      if (!raw::map(path, img))
+        return IMG_WRITE_ERR;
+    } else {
+      img.buffer.resize(img.word_count());
+    }
+    return OK;
+  }
+
+  std::uint32_t *band_data(const std::uint32_t &band, const std::uint32_t &y0,
+                           const std::size_t &band_pixels) {
+    std::size_t words = pixel_words(img.format);
+    if (!writer)
+      return img.data() + static_cast<std::size_t>(y0) * img.size[0] * words;
+    if (band >= ring.size())
+      writer->wait(band - ring.size() + 1);
+    std::vector<std::uint32_t> &slot = ring[band % ring.size()];
+    slot.resize(band_pixels * words);
+    return slot.data();
+  }
+
+  ExitCode finish(WritePool &pool) {
+    if (writer)
+      return writer->finish() ? OK : IMG_WRITE_ERR;
+    std::shared_ptr<Image> frame = std::make_shared<Image>(std::move(img));
+    if (video::is_video(spec.path)) {
+      std::shared_ptr<video::Writer> video = pool.video(spec, frame->size);
+      if (!video)
+        return IMG_WRITE_ERR;
+      return pool.submit([spec = spec, frame, video,
+                          index = video->reserve()](cl::sycl::queue &queue) {
+        std::vector<std::uint8_t> rgb =
+            to_rgb8(queue, *frame, spec.srgb, spec.dither);
+        return video->write_frame(index, rgb.data()) ? OK : IMG_WRITE_ERR;
+      });
+    }
+    return pool.submit([spec = spec, frame](cl::sycl::queue &queue) {
+      return write(queue, spec, *frame);
+    });
+  }
+
+  OutputSpec spec;
+  Image img;
+  std::unique_ptr<StreamWriter> writer;
+  std::vector<std::vector<std::uint32_t>> ring;
+};
+
+using OutputAccessor =
+    cl::sycl::accessor<std::uint32_t, 1, cl::sycl::access::mode::write>;
+
+template <std::size_t... I>
+static std::array<OutputAccessor, sizeof...(I)> output_access(
+    const std::array<cl::sycl::buffer<std::uint32_t> *, sizeof...(I)> &buffers,
+    cl::sycl::handler &cgh, std::index_sequence<I...>) {
+  return {buffers[I]->template get_access<cl::sycl::access::mode::write>(
+      cgh)...};
+}
+
+} // namespace tpm
+
+static std::vector<tpm::Light> scene_lights(const tpm::TpmSpec &spec) {
+  std::vector<tpm::Light> lights = spec.lights;
+  if (lights.empty())
+    lights.emplace_back(tpm::DIRECTIONAL,
+                        cl::sycl::normalize(cl::sycl::float3(1.0, 1.0, -1.0)),
+                        cl::sycl::float3(1.0, 1.0, 1.0));
+  return lights;
+}
+
+// Tile seeds are derived from the scene seed and the tile index alone, so
+// any process rendering a tile of the same scene seed draws the same
+// samples. Scenes without a seed get a random one per Renderer.
+static std::vector<cl::sycl::uint4>
+tile_seeds(const cl::sycl::uint2 &tiles,
+           const std::optional<std::uint32_t> &seed) {
+  std::uint32_t key = tpm::hash_step(seed ? *seed : std::random_device()());
+  std::vector<cl::sycl::uint4> seeds;
+  for (std::uint32_t i = 0; i < tiles[0] * tiles[1]; ++i)
+    seeds.push_back(tpm::seed_state(key + i));
+  return seeds;
+}
+
+template <typename T, int N>
+static bool same(const cl::sycl::vec<T, N> &lhs,
+                 const cl::sycl::vec<T, N> &rhs) {
+  for (int i = 0; i < N; ++i) {
+    if (lhs[i] != rhs[i])
+      return false;
+  }
+  return true;
+}
+
+static bool same(const tpm::Sdf &lhs, const tpm::Sdf &rhs) {
+  return lhs.type == rhs.type && lhs.mat == rhs.mat && lhs.a == rhs.a &&
+         lhs.b == rhs.b && same(lhs.args, rhs.args);
+}
+
+static bool same(const tpm::Mat &lhs, const tpm::Mat &rhs) {
+  return lhs.type == rhs.type && same(lhs.color, rhs.color) &&
+         same(lhs.args, rhs.args);
+}
+
+template <typename T>
+static void upload(cl::sycl::queue &queue, cl::sycl::buffer<T> &buffer,
+                   const std::vector<T> &host, const std::size_t &offset,
+                   const std::size_t &count) {
+  if (count == 0)
+    return;
+  queue.submit([&](cl::sycl::handler &cgh) {
+    auto ptr =
+        buffer.template get_access<cl::sycl::access::mode::discard_write>(
+            cgh, cl::sycl::range<1>(count), cl::sycl::id<1>(offset));
+    cgh.copy(host.data() + offset, ptr);
+  });
+}
+
+template <typename T>
+static std::size_t upload_dirty(cl::sycl::queue &queue,
+                                cl::sycl::buffer<T> &buffer,
+                                const std::vector<T> &host,
+                                std::vector<std::size_t> &dirty) {
+  std::sort(dirty.begin(), dirty.end());
+  std::size_t copies = 0;
+  for (std::size_t i = 0, end = 0; i < dirty.size(); i = end) {
+    for (end = i + 1;
+         end < dirty.size() && dirty[end] - dirty[end - 1] <= copy_gap; ++end)
+      ;
+    upload(queue, buffer, host, dirty[i], dirty[end - 1] - dirty[i] + 1);
+    ++copies;
+  }
+  return copies;
+}
+
+static std::size_t output_aovs(const tpm::TpmSpec &spec,
+                               std::array<tpm::AovType, tpm::max_outputs> &aovs,
+                               std::uint32_t &aov_mask) {
+  std::size_t output_count =
+      std::min(spec.image.outputs.size(), tpm::max_outputs);
+  for (std::size_t i = 0; i < output_count; ++i) {
+    aovs[i] = spec.image.outputs[i].aov;
+    aov_mask |= 1u << aovs[i];
+  }
+  return output_count;
 }
 
-tpm::ExitCode tpm::render_frame(const TpmSpec &spec) {
+// Core caps share out the host's cores between jobs and lanes, so they only
+// throttle host and cpu queues; other devices always get the full launch.
+static std::uint32_t core_cap(const cl::sycl::queue &queue,
+                              const std::uint32_t &cores) {
+  cl::sycl::device device = queue.get_device();
+  return device.is_host() || device.is_cpu() ? cores : 0;
+}
+
+template <typename F>
+static void parallel_tiles(cl::sycl::handler &cgh, const std::uint32_t &width,
+                           const std::uint32_t &y0, const std::uint32_t &height,
+                           const std::uint32_t &lanes, F render_tile) {
+  if (lanes == 0) {
+    cgh.parallel_for(cl::sycl::range<2>(width, height),
+                     [=](cl::sycl::item<2> item) {
+                       render_tile(cl::sycl::uint2(item[0], y0 + item[1]));
+                     });
+    return;
+  }
+  // A capped job launches one work item per core, each walking a strided
+  // share of the tiles, so it never occupies more cores.
+  std::uint32_t tiles = width * height;
+  std::uint32_t count = std::min(lanes, tiles);
+  cgh.parallel_for(cl::sycl::range<1>(count), [=](cl::sycl::item<1> item) {
+    for (std::uint32_t t = item[0]; t < tiles; t += count)
+      render_tile(cl::sycl::uint2(t % width, y0 + t / width));
+  });
+}
+
+tpm::Renderer::Renderer(const TpmSpec &spec, const cl::sycl::queue &queue)
+    : spec(spec),
+      img_size(spec.image.width, spec.image.height, spec.image.tile),
+      tile_size(Image(img_size).tile_size()), lights(scene_lights(spec)),
+      mats(frame_mats(spec, spec.sequence.start)),
+      roots(tile_size[0] * tile_size[1], 0),
+      seeds(tile_seeds(tile_size, spec.renderer.seed)),
+      queue(queue), seeds_buffer(seeds.data(), seeds.size()),
+      roots_buffer(cl::sycl::range<1>(std::max<std::size_t>(1, roots.size()))),
+      sdfs_buffer(cl::sycl::range<1>(1)),
+      mats_buffer(cl::sycl::range<1>(std::max<std::size_t>(1, mats.size()))),
+      lights_buffer(lights.data(), lights.size()) {
   PFUNC(&spec);
+  upload(queue, mats_buffer, mats, 0, mats.size());
+  build(frame_sdfs(spec, spec.sequence.start));
+}
+
+void tpm::Renderer::build(std::vector<Sdf> nodes) {
+  PFUNC(nodes.size());
+  base = nodes.size();
+  sdfs = nodes;
+  parents = sdf_parents(nodes);
+  slots.assign(roots.size(), TileSlot{0, 0});
+  std::fill(roots.begin(), roots.end(), 0);
+  if (spec.renderer.prune) {
+    std::vector<Sdf> tile;
+    for (std::uint32_t x = 0, i = 0; x < tile_size[0]; ++x) {
+      for (std::uint32_t y = 0; y < tile_size[1]; ++y, ++i) {
+        roots[i] = prune_tile(img_size, cl::sycl::uint2(x, y), max_t, nodes,
+                              sdfs.size(), tile);
+        slots[i] = TileSlot{sdfs.size(), tile.size()};
+        sdfs.insert(sdfs.end(), tile.begin(), tile.end());
+      }
+    }
+    LINFO("Pruned SDF of {} nodes into {} tile nodes over {} tiles", base,
+          sdfs.size() - base, roots.size());
+  }
+  // Tiles whose pruned tree outgrows its slot after an update are moved
+  // into this headroom instead of re-laying out the whole buffer.
+  tail = sdfs.size();
+  if (spec.renderer.prune)
+    sdfs.resize(tail + tail / 2, Sdf(SPHERE));
+
+  sdfs_buffer = cl::sycl::buffer<Sdf>(
+      cl::sycl::range<1>(std::max<std::size_t>(1, sdfs.size())));
+  upload(queue, sdfs_buffer, sdfs, 0, sdfs.size());
+  upload(queue, roots_buffer, roots, 0, roots.size());
+}
 
-  cl::sycl::queue queue;
-  Image img(spec.image.width, spec.image.height, spec.image.tile);
+void tpm::Renderer::update(const std::uint32_t &frame) {
+  if (spec.sequence.keys.empty() && spec.sequence.mat_keys.empty())
+    return;
+  PFUNC(frame);
+  // The copies of the previous frame read straight from the host mirrors.
+  queue.wait();
 
-  {
-    PSCOPE("RenderKernel", img.size, img.tile_size());
-    cl::sycl::uint3 img_size = img.size;
-    cl::sycl::uint2 tile_size = img.tile_size();
-
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<std::uint32_t> dist;
-
-    std::vector<cl::sycl::uint4> seeds;
-    for (std::size_t i = 0; i < tile_size[0] * tile_size[1]; ++i)
-      seeds.push_back(
-          cl::sycl::uint4(dist(gen), dist(gen), dist(gen), dist(gen)));
-
-    cl::sycl::buffer<cl::sycl::float3> img_buffer(img.buffer.data(),
-                                                  img.buffer.size());
-    cl::sycl::buffer<cl::sycl::uint4> seeds_buffer(seeds.data(), seeds.size());
-    cl::sycl::buffer<Sdf> sdfs_buffer(spec.sdfs.data(), spec.sdfs.size());
-    cl::sycl::buffer<Mat> mats_buffer(spec.mats.data(), spec.mats.size());
-
-    queue.submit([&](cl::sycl::handler &cgh) {
-      cl::sycl::accessor<cl::sycl::float3, 1, cl::sycl::access::mode::write>
-          buffer_ptr =
-              img_buffer.get_access<cl::sycl::access::mode::write>(cgh);
-      cl::sycl::accessor<cl::sycl::uint4, 1, cl::sycl::access::mode::read>
-          seeds_ptr =
-              seeds_buffer.get_access<cl::sycl::access::mode::read>(cgh);
-      cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> sdfs_ptr =
-          sdfs_buffer.get_access<cl::sycl::access::mode::read>(cgh);
-      cl::sycl::accessor<Mat, 1, cl::sycl::access::mode::read> mats_ptr =
-          mats_buffer.get_access<cl::sycl::access::mode::read>(cgh);
-
-      cgh.parallel_for(
-          cl::sycl::range<2>(tile_size[0], tile_size[1]),
-          [=](cl::sycl::item<2> item) {
-            cl::sycl::uint4 tile =
-                Image::tile(img_size, cl::sycl::uint2(item[0], item[1]));
-            cl::sycl::uint4 seed = seeds_ptr[item.get_linear_id()];
-
-            PFUNC(tile, seed);
-
-            for (std::uint32_t x = tile[0]; x < tile[2]; ++x) {
-              for (std::uint32_t y = tile[1]; y < tile[3]; ++y) {
-                buffer_ptr[Image::idx(img_size, cl::sycl::uint2(x, y))] =
-                    render_pixel(
-                        cl::sycl::uint4(x, y, img_size[0], img_size[1]), seed,
-                        sdfs_ptr, mats_ptr);
+  std::vector<std::size_t> dirty;
+  std::vector<Mat> next_mats = frame_mats(spec, frame);
+  for (std::size_t i = 0; i < mats.size(); ++i) {
+    if (same(mats[i], next_mats[i]))
+      continue;
+    mats[i] = next_mats[i];
+    dirty.push_back(i);
+  }
+  std::size_t mat_count = dirty.size();
+  std::size_t copies = upload_dirty(queue, mats_buffer, mats, dirty);
+
+  dirty.clear();
+  std::vector<Sdf> prev(sdfs.begin(), sdfs.begin() + base);
+  std::vector<Sdf> next = frame_sdfs(spec, frame);
+  std::vector<bool> changed(base, false);
+  for (std::size_t i = 0; i < base; ++i) {
+    if (same(sdfs[i], next[i]))
+      continue;
+    sdfs[i] = next[i];
+    changed[i] = true;
+    dirty.push_back(i);
+  }
+  std::size_t sdf_count = dirty.size();
+  if (sdf_count == 0 && mat_count == 0)
+    return;
+
+  // Only the topmost changed nodes matter, the rest sit in their subtrees.
+  std::vector<std::size_t> tops;
+  for (const std::size_t &i : dirty) {
+    std::size_t up = parents[i];
+    while (up < base && !changed[up])
+      up = parents[up];
+    if (up >= base)
+      tops.push_back(i);
+  }
+
+  bool roots_dirty = false;
+  std::size_t repruned = 0;
+  if (sdf_count != 0 && spec.renderer.prune) {
+    std::vector<Sdf> tile;
+    for (std::uint32_t x = 0, i = 0; x < tile_size[0]; ++x) {
+      for (std::uint32_t y = 0; y < tile_size[1]; ++y, ++i) {
+        cl::sycl::uint2 id(x, y);
+        std::vector<Interval3> regions =
+            tile_bounds(img_size, Image::tile(img_size, id), max_t);
+        bool reached = false;
+        for (std::size_t j = 0; !reached && j < tops.size(); ++j)
+          reached = prune_reaches(regions, tops[j], parents, prev) ||
+                    prune_reaches(regions, tops[j], parents, next);
+        if (!reached)
+          continue;
+        ++repruned;
+        std::size_t root =
+            prune_tile(img_size, id, max_t, next, slots[i].offset, tile);
+        if (tile.size() > slots[i].capacity) {
+          if (tail + tile.size() > sdfs.size()) {
+            LINFO("Frame {} outgrew the tile node headroom, rebuilding the "
+                  "pruned SDF",
+                  frame);
+            build(std::move(next));
+            return;
+          }
+          slots[i] = TileSlot{tail, tile.size()};
+          tail += tile.size();
+          root = prune_tile(img_size, id, max_t, next, slots[i].offset, tile);
+        }
+        for (std::size_t j = 0; j < tile.size(); ++j) {
+          std::size_t idx = slots[i].offset + j;
+          if (same(sdfs[idx], tile[j]))
+            continue;
+          sdfs[idx] = tile[j];
+          dirty.push_back(idx);
+        }
+        if (roots[i] != root) {
+          roots[i] = root;
+          roots_dirty = true;
+        }
+      }
+    }
+  }
+
+  std::size_t node_count = dirty.size();
+  copies += upload_dirty(queue, sdfs_buffer, sdfs, dirty);
+  if (roots_dirty) {
+    upload(queue, roots_buffer, roots, 0, roots.size());
+    ++copies;
+  }
+  LINFO("Frame {} changed {} SDF nodes and {} materials, re-pruned {} tiles "
+        "and uploaded {} nodes in {} copies",
+        frame, sdf_count, mat_count, repruned, node_count, copies);
+}
+
+tpm::ExitCode tpm::Renderer::restore(const std::filesystem::path &path) {
+  PFUNC(path.string());
+  std::shared_ptr<checkpoint::State> state = checkpoint::read(path);
+  if (!state) {
+    LERR("Failed to read checkpoint \"{}\"", path.string());
+    return CHECKPOINT_ERROR;
+  }
+  std::size_t output_count = std::min(spec.image.outputs.size(), max_outputs);
+  bool matches = state->size[0] == img_size[0] &&
+                 state->size[1] == img_size[1] &&
+                 state->size[2] == img_size[2] &&
+                 state->seeds.size() == seeds.size() &&
+                 state->aovs.size() == output_count &&
+                 state->frame >= spec.sequence.start &&
+                 state->frame <= spec.sequence.end;
+  for (std::size_t i = 0; matches && i < output_count; ++i)
+    matches = state->aovs[i] == spec.image.outputs[i].aov;
+  if (!matches) {
+    LERR("Checkpoint \"{}\" was written for a different image or outputs",
+         path.string());
+    return CHECKPOINT_ERROR;
+  }
+  resume = state;
+  return OK;
+}
+
+void tpm::Renderer::render_pass(
+    const std::uint32_t &pass, const std::uint32_t &first,
+    cl::sycl::buffer<cl::sycl::float3> &accum_buffer,
+    const std::array<AovType, max_outputs> &aovs,
+    const std::uint32_t &aov_mask, const std::size_t &output_count) {
+  PFUNC(pass, first);
+  cl::sycl::uint3 img_size = this->img_size;
+  cl::sycl::uint2 tile_size = this->tile_size;
+  RendererSpec renderer = spec.renderer;
+  std::uint32_t cap = core_cap(queue, renderer.cores);
+  std::size_t pixels = static_cast<std::size_t>(img_size[0]) * img_size[1];
+  queue.submit([&](cl::sycl::handler &cgh) {
+    cl::sycl::accessor<cl::sycl::float3, 1,
+                       cl::sycl::access::mode::read_write>
+        accum_ptr =
+            accum_buffer.get_access<cl::sycl::access::mode::read_write>(
+                cgh);
+    cl::sycl::accessor<cl::sycl::uint4, 1, cl::sycl::access::mode::read>
+        seeds_ptr =
+            seeds_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+    cl::sycl::accessor<std::size_t, 1, cl::sycl::access::mode::read>
+        roots_ptr =
+            roots_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+    cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> sdfs_ptr =
+        sdfs_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+    cl::sycl::accessor<Mat, 1, cl::sycl::access::mode::read> mats_ptr =
+        mats_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+    cl::sycl::accessor<Light, 1, cl::sycl::access::mode::read> lights_ptr =
+        lights_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+
+    parallel_tiles(
+        cgh, tile_size[0], 0, tile_size[1], cap,
+        [=](const cl::sycl::uint2 &id) {
+          cl::sycl::uint4 tile = Image::tile(img_size, id);
+          std::size_t linear = id[0] * tile_size[1] + id[1];
+          cl::sycl::uint4 seed = pass_seed(seeds_ptr[linear], pass);
+          std::size_t root = roots_ptr[linear];
+
+          for (std::uint32_t x = tile[0]; x < tile[2]; ++x) {
+            for (std::uint32_t y = tile[1]; y < tile[3]; ++y) {
+              Aovs sample = render_pixel(
+                  cl::sycl::uint4(x, y, img_size[0], img_size[1]), seed,
+                  root, renderer, aov_mask, sdfs_ptr, mats_ptr, lights_ptr);
+              std::size_t idx = Image::idx(img_size, cl::sycl::uint2(x, y));
+              for (std::size_t i = 0; i < output_count; ++i) {
+                cl::sycl::float3 value = aov_value(sample, aovs[i]);
+                cl::sycl::float3 &acc = accum_ptr[i * pixels + idx];
+                // Depth, normal and material ids keep the first pass;
+                // averaging them across jittered rays blurs edges.
+                if (pass == first)
+                  acc = value;
+                else if (aovs[i] == BEAUTY || aovs[i] == STEPS)
+                  acc += (value - acc) / static_cast<float>(pass - first + 1);
               }
             }
-          });
+          }
+        });
+  });
+}
+
+std::uint32_t tpm::Renderer::passes() const {
+  return static_cast<std::uint32_t>(
+      std::max<std::size_t>(1, spec.renderer.spp / sample_count));
+}
+
+std::uint32_t tpm::Renderer::accumulate(
+    const std::uint32_t &frame,
+    const std::chrono::steady_clock::time_point &start,
+    cl::sycl::buffer<cl::sycl::float3> &accum_buffer,
+    const std::array<AovType, max_outputs> &aovs,
+    const std::uint32_t &aov_mask, const std::size_t &output_count) {
+  PFUNC(spec.renderer.budget, output_count);
+  RendererSpec renderer = spec.renderer;
+  std::size_t pixels = static_cast<std::size_t>(img_size[0]) * img_size[1];
+  std::chrono::milliseconds budget(renderer.budget);
+  std::uint32_t max_passes = passes();
+
+  std::uint32_t pass = 0;
+  if (resume && resume->frame == frame) {
+    PSCOPE("Resume", resume->passes);
+    {
+      auto seeds_ptr =
+          seeds_buffer.get_access<cl::sycl::access::mode::write>();
+      for (std::size_t i = 0; i < resume->seeds.size(); ++i)
+        seeds_ptr[i] = resume->seeds[i];
+      auto accum_ptr =
+          accum_buffer.get_access<cl::sycl::access::mode::discard_write>();
+      for (std::size_t i = 0; i < resume->accum.size(); ++i)
+        accum_ptr[i] = resume->accum[i];
+    }
+    pass = resume->passes;
+    LINFO("Resuming frame {} after {} passes", frame, pass);
+    resume.reset();
+  }
+
+  std::filesystem::path checkpoint_path =
+      spec.checkpoint.path.empty() ? std::string()
+                                   : frame_path(spec.checkpoint.path, frame);
+  std::chrono::seconds interval(spec.checkpoint.interval);
+  std::chrono::steady_clock::time_point saved = start;
+  std::chrono::steady_clock::duration last{};
+  for (; pass < max_passes; ++pass) {
+    std::chrono::steady_clock::time_point begin =
+        std::chrono::steady_clock::now();
+    if (renderer.budget != 0 && pass != 0 && begin - start + last > budget)
+      break;
+    render_pass(pass, 0, accum_buffer, aovs, aov_mask, output_count);
+    queue.wait();
+    std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now();
+    last = end - begin;
+
+    // The render thread only copies the accumulator out; packing and disk
+    // I/O run on the checkpoint writer, and a checkpoint is skipped while
+    // the previous one is still being written.
+    if (!checkpoint_path.empty() && pass + 1 < max_passes &&
+        end - saved >= interval && !checkpoints.busy()) {
+      PSCOPE("Checkpoint", pass + 1);
+      saved = end;
+      std::shared_ptr<checkpoint::State> state =
+          std::make_shared<checkpoint::State>();
+      state->size = img_size;
+      state->frame = frame;
+      state->passes = pass + 1;
+      state->aovs.assign(aovs.begin(), aovs.begin() + output_count);
+      {
+        auto seeds_ptr =
+            seeds_buffer.get_access<cl::sycl::access::mode::read>();
+        for (std::size_t i = 0; i < seeds.size(); ++i)
+          state->seeds.push_back(seeds_ptr[i]);
+        auto accum_ptr =
+            accum_buffer.get_access<cl::sycl::access::mode::read>();
+        state->accum.reserve(pixels * output_count);
+        for (std::size_t i = 0; i < pixels * output_count; ++i)
+          state->accum.push_back(accum_ptr[i]);
+      }
+      checkpoints.offer(checkpoint_path, std::move(state));
+    }
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  if (renderer.budget == 0)
+    LINFO("Rendered {} passes ({} spp) in {} ms", pass, pass * sample_count,
+          elapsed.count());
+  else if (elapsed > budget)
+    LWARN("Rendered {} passes ({} spp) in {} ms, over the {} ms budget", pass,
+          pass * sample_count, elapsed.count(), renderer.budget);
+  else
+    LINFO("Rendered {} passes ({} spp) in {} ms of a {} ms budget", pass,
+          pass * sample_count, elapsed.count(), renderer.budget);
+  return pass;
+}
+
+// Runs every pass of one tile of render_tiles into its slice of out, in the
+// same order and from the same pass seeds as render_pass, so the gathered
+// frame matches a local render bit for bit.
+template <typename Out, typename Sdfs, typename Mats, typename Lights>
+static void tile_passes(const cl::sycl::uint3 &img_size,
+                        const cl::sycl::uint4 &tile,
+                        const cl::sycl::uint4 &tile_seed,
+                        const std::size_t &root,
+                        const std::uint32_t &pass_count,
+                        const tpm::RendererSpec &renderer,
+                        const std::array<tpm::AovType, tpm::max_outputs> &aovs,
+                        const std::uint32_t &aov_mask,
+                        const std::size_t &output_count, const Out &out,
+                        const std::size_t &base, const Sdfs &sdfs,
+                        const Mats &mats, const Lights &lights) {
+  std::size_t area = static_cast<std::size_t>(img_size[2]) * img_size[2];
+  for (std::uint32_t pass = 0; pass < pass_count; ++pass) {
+    cl::sycl::uint4 seed = tpm::pass_seed(tile_seed, pass);
+    for (std::uint32_t x = tile[0]; x < tile[2]; ++x) {
+      for (std::uint32_t y = tile[1]; y < tile[3]; ++y) {
+        tpm::Aovs sample = tpm::render_pixel(
+            cl::sycl::uint4(x, y, img_size[0], img_size[1]), seed, root,
+            renderer, aov_mask, sdfs, mats, lights);
+        std::size_t local = (y - tile[1]) * img_size[2] + (x - tile[0]);
+        for (std::size_t i = 0; i < output_count; ++i) {
+          cl::sycl::float3 value = tpm::aov_value(sample, aovs[i]);
+          cl::sycl::float3 &acc = out[base + i * area + local];
+          if (pass == 0)
+            acc = value;
+          else if (aovs[i] == tpm::BEAUTY || aovs[i] == tpm::STEPS)
+            acc += (value - acc) / static_cast<float>(pass + 1);
+        }
+      }
+    }
+  }
+}
+
+void tpm::Renderer::render_tiles(const std::uint32_t &frame,
+                                 const std::vector<std::uint32_t> &tiles,
+                                 std::vector<cl::sycl::float3> &out,
+                                 const std::vector<int> &cpus) {
+  PFUNC(frame, tiles.size());
+  update(frame);
+
+  cl::sycl::uint3 img_size = this->img_size;
+  cl::sycl::uint2 tile_size = this->tile_size;
+  std::array<AovType, max_outputs> aovs{};
+  std::uint32_t aov_mask = 0;
+  std::size_t output_count = output_aovs(spec, aovs, aov_mask);
+  std::size_t area = static_cast<std::size_t>(img_size[2]) * img_size[2];
+  out.assign(tiles.size() * output_count * area, cl::sycl::float3(0.0f));
+  if (tiles.empty())
+    return;
+
+  RendererSpec renderer = spec.renderer;
+  std::uint32_t pass_count = passes();
+  if (!cpus.empty()) {
+    // A NUMA lane renders on host threads pinned to its node. They read the
+    // host mirrors of this renderer, which were built and updated by the
+    // lane's own pinned thread, so every scene read stays on the node
+    // rather than going to wherever the runtime placed its buffers.
+    HostView<Sdf> sdfs_view{sdfs.data(), sdfs.size()};
+    HostView<Mat> mats_view{mats.data(), mats.size()};
+    HostView<Light> lights_view{lights.data(), lights.size()};
+    cl::sycl::float3 *out_ptr = out.data();
+    host_parallel_for(
+        tiles.size(), cpus.size(), [&]() { device::pin(cpus); },
+        [&](const std::size_t &k) {
+          std::uint32_t linear = tiles[k];
+          cl::sycl::uint4 tile = Image::tile(
+              img_size,
+              cl::sycl::uint2(linear / tile_size[1], linear % tile_size[1]));
+          tile_passes(img_size, tile, seeds[linear], roots[linear],
+                      pass_count, renderer, aovs, aov_mask, output_count,
+                      out_ptr, k * output_count * area, sdfs_view, mats_view,
+                      lights_view);
+        });
+    return;
+  }
+
+  std::uint32_t cap = core_cap(queue, renderer.cores);
+  cl::sycl::buffer<std::uint32_t> tiles_buffer(
+      tiles.data(), cl::sycl::range<1>(tiles.size()));
+  cl::sycl::buffer<cl::sycl::float3> out_buffer(out.data(),
+                                                cl::sycl::range<1>(out.size()));
+  queue.submit([&](cl::sycl::handler &cgh) {
+    cl::sycl::accessor<std::uint32_t, 1, cl::sycl::access::mode::read>
+        tiles_ptr =
+            tiles_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+    auto out_ptr =
+        out_buffer.get_access<cl::sycl::access::mode::discard_write>(cgh);
+    cl::sycl::accessor<cl::sycl::uint4, 1, cl::sycl::access::mode::read>
+        seeds_ptr = seeds_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+    cl::sycl::accessor<std::size_t, 1, cl::sycl::access::mode::read>
+        roots_ptr = roots_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+    cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> sdfs_ptr =
+        sdfs_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+    cl::sycl::accessor<Mat, 1, cl::sycl::access::mode::read> mats_ptr =
+        mats_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+    cl::sycl::accessor<Light, 1, cl::sycl::access::mode::read> lights_ptr =
+        lights_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+
+    // As in parallel_tiles, a core cap launches one work item per core
+    // striding over the tiles.
+    std::size_t n = tiles.size();
+    std::size_t lanes = cap != 0 ? std::min<std::size_t>(cap, n) : n;
+    cgh.parallel_for(cl::sycl::range<1>(lanes), [=](cl::sycl::item<1> item) {
+      for (std::size_t k = item[0]; k < n; k += lanes) {
+        std::uint32_t linear = tiles_ptr[k];
+        cl::sycl::uint4 tile = Image::tile(
+            img_size,
+            cl::sycl::uint2(linear / tile_size[1], linear % tile_size[1]));
+
+        PFUNC(tile, seeds_ptr[linear]);
+
+        tile_passes(img_size, tile, seeds_ptr[linear], roots_ptr[linear],
+                    pass_count, renderer, aovs, aov_mask, output_count,
+                    out_ptr, k * output_count * area, sdfs_ptr, mats_ptr,
+                    lights_ptr);
+      }
     });
+  });
+}
+
+void tpm::Renderer::render_passes(const std::uint32_t &frame,
+                                  const std::uint32_t &first,
+                                  const std::uint32_t &count,
+                                  std::vector<cl::sycl::float3> &out) {
+  PFUNC(frame, first, count);
+  update(frame);
+
+  std::array<AovType, max_outputs> aovs{};
+  std::uint32_t aov_mask = 0;
+  std::size_t output_count = output_aovs(spec, aovs, aov_mask);
+  out.assign(static_cast<std::size_t>(img_size[0]) * img_size[1] *
+                 output_count,
+             cl::sycl::float3(0.0f));
+  if (out.empty())
+    return;
+  cl::sycl::buffer<cl::sycl::float3> out_buffer(
+      out.data(), cl::sycl::range<1>(out.size()));
+  for (std::uint32_t pass = first; pass < first + count; ++pass)
+    render_pass(pass, first, out_buffer, aovs, aov_mask, output_count);
+}
+
+tpm::ExitCode
+tpm::Renderer::render(const std::uint32_t &frame, WritePool &pool,
+                      const std::vector<cl::sycl::float3> *gathered) {
+  PFUNC(frame);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  if (gathered == nullptr)
+    update(frame);
+
+  cl::sycl::uint3 img_size = this->img_size;
+  cl::sycl::uint2 tile_size = this->tile_size;
+  std::size_t output_count =
+      std::min(spec.image.outputs.size(), max_outputs);
+  std::vector<Target> targets;
+  targets.reserve(output_count);
+  std::array<AovType, max_outputs> aovs{};
+  std::array<PixelFormat, max_outputs> formats{};
+  std::uint32_t aov_mask = 0;
+  for (std::size_t i = 0; i < output_count; ++i) {
+    OutputSpec output = spec.image.outputs[i];
+    output.path = frame_path(output.path, frame);
+    targets.emplace_back(output, img_size);
+    ExitCode ret = targets.back().open(queue);
+    if (ret != OK)
+      return ret;
+    aovs[i] = output.aov;
+    formats[i] = output.format;
+    aov_mask |= 1u << aovs[i];
   }
 
-  write(spec.image.path, img);
+  {
+    PSCOPE("RenderKernel", img_size, output_count);
+    RendererSpec renderer = spec.renderer;
+    std::uint32_t cap = core_cap(queue, renderer.cores);
+
+    std::array<std::uint32_t, max_outputs> unused{};
+    std::vector<std::unique_ptr<cl::sycl::buffer<std::uint32_t>>>
+        unused_buffers;
+    for (std::size_t i = output_count; i < max_outputs; ++i)
+      unused_buffers.push_back(
+          std::make_unique<cl::sycl::buffer<std::uint32_t>>(&unused[i], 1));
 
-  return OK;
+    std::uint32_t cores =
+        cap != 0 ? cap : std::max(1u, std::thread::hardware_concurrency());
+    std::uint32_t band_tiles = std::max<std::uint32_t>(
+        1, (band_items * cores + tile_size[0] - 1) / tile_size[0]);
+    std::size_t band_pixels =
+        static_cast<std::size_t>(band_tiles) * img_size[2] * img_size[0];
+    std::size_t pixels = static_cast<std::size_t>(img_size[0]) * img_size[1];
+
+    // A frame of several passes, or with a time budget, is rendered as
+    // spp / sample_count progressive passes into an accumulation buffer,
+    // and the band loop below only resolves it into the outputs. A frame
+    // gathered from distributed workers or device lanes arrives already in
+    // that layout. A single-pass frame renders straight into the bands with
+    // the samples pass 0 would draw, so checkpoints never change the image.
+    bool resolve = gathered != nullptr || passes() > 1 ||
+                   renderer.budget != 0 || (resume && resume->frame == frame);
+    cl::sycl::buffer<cl::sycl::float3> accum_buffer =
+        gathered != nullptr
+            ? cl::sycl::buffer<cl::sycl::float3>(
+                  gathered->data(), cl::sycl::range<1>(gathered->size()))
+            : cl::sycl::buffer<cl::sycl::float3>(
+                  cl::sycl::range<1>(resolve ? pixels * output_count : 1));
+    if (resolve && gathered == nullptr)
+      accumulate(frame, start, accum_buffer, aovs, aov_mask, output_count);
+    for (const Target &target : targets) {
+      if (target.writer)
+        LINFO("Streaming \"{}\" {} rows per band through {} band buffers "
+              "({} MiB)",
+              target.spec.path, band_tiles * img_size[2], target.ring.size(),
+              target.ring.size() * band_pixels *
+                      pixel_words(target.img.format) * sizeof(std::uint32_t) >>
+                  20);
+    }
+
+    struct InFlight {
+      std::vector<Band> bands;
+      std::vector<std::unique_ptr<cl::sycl::buffer<std::uint32_t>>> buffers;
+    };
+    std::deque<InFlight> in_flight;
+    auto retire = [&]() {
+      InFlight &front = in_flight.front();
+      front.buffers.clear();
+      for (std::size_t i = 0; i < targets.size(); ++i) {
+        if (targets[i].writer)
+          targets[i].writer->push(front.bands[i]);
+      }
+      in_flight.pop_front();
+    };
+
+    for (std::uint32_t band_y = 0, band = 0; band_y < tile_size[1];
+         band_y += band_tiles, ++band) {
+      std::uint32_t band_h = std::min(band_tiles, tile_size[1] - band_y);
+      std::uint32_t y0 = band_y * img_size[2],
+                    y1 = std::min(img_size[1], (band_y + band_h) * img_size[2]);
+      InFlight &next = in_flight.emplace_back();
+      std::array<cl::sycl::buffer<std::uint32_t> *, max_outputs> band_buffers;
+      for (std::size_t i = 0; i < max_outputs; ++i) {
+        if (i >= output_count) {
+          band_buffers[i] = unused_buffers[i - output_count].get();
+          continue;
+        }
+        std::uint32_t *data = targets[i].band_data(band, y0, band_pixels);
+        next.bands.push_back(Band{y0, y1, PixelView{data, formats[i]}});
+        next.buffers.push_back(
+            std::make_unique<cl::sycl::buffer<std::uint32_t>>(
+                data,
+                static_cast<std::size_t>(y1 - y0) * img_size[0] *
+                    pixel_words(formats[i]),
+                cl::sycl::property::buffer::use_host_ptr()));
+        band_buffers[i] = next.buffers.back().get();
+      }
+
+      queue.submit([&](cl::sycl::handler &cgh) {
+        std::array<OutputAccessor, max_outputs> outputs_ptr = output_access(
+            band_buffers, cgh, std::make_index_sequence<max_outputs>());
+        cl::sycl::accessor<cl::sycl::uint4, 1, cl::sycl::access::mode::read>
+            seeds_ptr =
+                seeds_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+        cl::sycl::accessor<std::size_t, 1, cl::sycl::access::mode::read>
+            roots_ptr =
+                roots_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+        cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> sdfs_ptr =
+            sdfs_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+        cl::sycl::accessor<Mat, 1, cl::sycl::access::mode::read> mats_ptr =
+            mats_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+        cl::sycl::accessor<Light, 1, cl::sycl::access::mode::read>
+            lights_ptr =
+                lights_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+        cl::sycl::accessor<cl::sycl::float3, 1, cl::sycl::access::mode::read>
+            accum_ptr =
+                accum_buffer.get_access<cl::sycl::access::mode::read>(cgh);
+
+        auto render_tile = [=](const cl::sycl::uint2 &id) {
+          cl::sycl::uint4 tile = Image::tile(img_size, id);
+          std::size_t linear = id[0] * tile_size[1] + id[1];
+          cl::sycl::uint4 seed = seeds_ptr[linear];
+          std::size_t root = roots_ptr[linear];
+
+          PFUNC(tile, seed);
+
+          for (std::uint32_t x = tile[0]; x < tile[2]; ++x) {
+            for (std::uint32_t y = tile[1]; y < tile[3]; ++y) {
+              std::size_t idx =
+                  Image::idx(img_size, cl::sycl::uint2(x, y - y0));
+              if (resolve) {
+                std::size_t src = Image::idx(img_size, cl::sycl::uint2(x, y));
+                for (std::size_t i = 0; i < output_count; ++i)
+                  store_pixel(formats[i], outputs_ptr[i], idx,
+                              accum_ptr[i * pixels + src]);
+                continue;
+              }
+              Aovs sample = render_pixel(
+                  cl::sycl::uint4(x, y, img_size[0], img_size[1]), seed, root,
+                  renderer, aov_mask, sdfs_ptr, mats_ptr, lights_ptr);
+              for (std::size_t i = 0; i < output_count; ++i)
+                store_pixel(formats[i], outputs_ptr[i], idx,
+                            aov_value(sample, aovs[i]));
+            }
+          }
+        };
+
+        parallel_tiles(cgh, tile_size[0], band_y, band_h, cap, render_tile);
+      });
+
+      while (in_flight.size() > stream_depth)
+        retire();
+    }
+    while (!in_flight.empty())
+      retire();
+  }
+
+  ExitCode ret = OK;
+  for (Target &target : targets) {
+    ExitCode target_ret = target.finish(pool);
+    if (ret == OK)
+      ret = target_ret;
+  }
+  return ret;
 }
 
-tpm::ExitCode tpm::write(const std::filesystem::path &path, const Image &img) {
-  PFUNC(path.string(), &img);
+tpm::ExitCode tpm::Renderer::render_sequence(WritePool &pool) {
+  ExitCode status = OK;
+  for (std::uint32_t frame = resume ? resume->frame : spec.sequence.start;
+       status == OK && frame <= spec.sequence.end; ++frame) {
+    LINFO("Rendering frame {} of {}-{}", frame, spec.sequence.start,
+          spec.sequence.end);
+    status = render(frame, pool);
+  }
+  return status;
+}
 
+tpm::ExitCode tpm::render_frame(const TpmSpec &spec, WritePool &pool) {
+  std::vector<device::Slice> slices = device::select(spec.device.select);
+  if (slices.empty()) {
+    LERR("No SYCL device matches \"{}\"", spec.device.select);
+    return DEVICE_ERROR;
+  }
+  Renderer renderer(spec, cl::sycl::queue(slices.front().device));
+  return renderer.render(spec.sequence.start, pool);
+}
+
+tpm::ExitCode tpm::make_output_dir(const std::filesystem::path &path) {
   if (!path.parent_path().empty() &&
       !std::filesystem::exists(path.parent_path())) {
     LINFO("Creating output directory \"{}\"", path.parent_path().string());
@@ -209,68 +1231,56 @@ tpm::ExitCode tpm::write(const std::filesystem::path &path, const Image &img) {
       return MKDIR_ERROR;
     }
   }
+  return OK;
+}
 
-  if (path.extension() == ".png") {
-    std::uint8_t *data = static_cast<std::uint8_t *>(
-        malloc(img.size[0] * img.size[0] * 3 * sizeof(std::uint8_t)));
-    for (std::size_t i = 0; i < img.size[0] * img.size[0]; ++i) {
-      std::size_t idx = 3 * i;
-      data[idx + 0] = static_cast<std::uint8_t>(img.buffer[i][0] * 255.0f);
-      data[idx + 1] = static_cast<std::uint8_t>(img.buffer[i][1] * 255.0f);
-      data[idx + 2] = static_cast<std::uint8_t>(img.buffer[i][2] * 255.0f);
-    }
+tpm::ExitCode tpm::write(cl::sycl::queue &queue, const OutputSpec &spec,
+                         const Image &img) {
+  std::filesystem::path path = spec.path;
+  PFUNC(path.string(), &img);
 
-    bool ret =
-        (stbi_write_png(path.c_str(), static_cast<int>(img.size[0]),
-                        static_cast<int>(img.size[1]), static_cast<int>(3),
-                        data, static_cast<int>(img.size[0] * 3)) != 0);
-    free(data);
-
-    if (!ret)
-      return IMG_WRITE_ERR;
-  } else if (path.extension() == ".jpg" || path.extension() == "jpeg" ||
-             path.extension() == "jpe") {
-    std::uint8_t *data = static_cast<std::uint8_t *>(
-        malloc(img.size[0] * img.size[0] * 3 * sizeof(std::uint8_t)));
-    for (std::size_t i = 0; i < img.size[0] * img.size[0]; ++i) {
-      std::size_t idx = 3 * i;
-      data[idx + 0] = static_cast<std::uint8_t>(img.buffer[i][0] * 255.0f);
-      data[idx + 1] = static_cast<std::uint8_t>(img.buffer[i][1] * 255.0f);
-      data[idx + 2] = static_cast<std::uint8_t>(img.buffer[i][2] * 255.0f);
-    }
+  ExitCode dir = make_output_dir(path);
+  if (dir != OK)
+    return dir;
 
-    bool ret = (stbi_write_jpg(path.c_str(), static_cast<int>(img.size[0]),
-                               static_cast<int>(img.size[1]),
-                               static_cast<int>(3), data, 100) != 0);
-    free(data);
-
-    if (!ret)
-      return IMG_WRITE_ERR;
-  } else if (path.extension() == ".bmp") {
-    std::uint8_t *data = static_cast<std::uint8_t *>(
-        malloc(img.size[0] * img.size[0] * 3 * sizeof(std::uint8_t)));
-    for (std::size_t i = 0; i < img.size[0] * img.size[0]; ++i) {
-      std::size_t idx = 3 * i;
-      data[idx + 0] = static_cast<std::uint8_t>(img.buffer[i][0] * 255.0f);
-      data[idx + 1] = static_cast<std::uint8_t>(img.buffer[i][1] * 255.0f);
-      data[idx + 2] = static_cast<std::uint8_t>(img.buffer[i][2] * 255.0f);
+  std::filesystem::path ext = path.extension();
+  bool ret = true;
+  if (ext == ".hdr") {
+    std::vector<float> data(static_cast<std::size_t>(img.size[0]) *
+                            img.size[1] * 3);
+    for (std::size_t i = 0; i < data.size() / 3; ++i) {
+      cl::sycl::float3 v = img.get(i);
+      for (int c = 0; c < 3; ++c)
+        data[3 * i + c] = v[c];
     }
-
-    bool ret = (stbi_write_bmp(path.c_str(), static_cast<int>(img.size[0]),
-                               static_cast<int>(img.size[1]),
-                               static_cast<int>(3), data) != 0);
-    free(data);
-
-    if (!ret)
-      return IMG_WRITE_ERR;
-  } else if (path.extension() == ".hdr") {
-    bool ret = (stbi_write_hdr(
-                    path.c_str(), static_cast<int>(img.size[0]),
-                    static_cast<int>(img.size[1]), static_cast<int>(3),
-                    reinterpret_cast<const float *>(img.buffer.data())) != 0);
-    if (!ret)
-      return IMG_WRITE_ERR;
+    ret = (stbi_write_hdr(path.c_str(), static_cast<int>(img.size[0]),
+                          static_cast<int>(img.size[1]), static_cast<int>(3),
+                          data.data()) != 0);
+  } else if (ext == ".exr") {
+    ret = exr::write(path, img, spec.compression);
+  } else if (ext == ".raw") {
+    ret = raw::write(path, img);
+  } else if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" ||
+             ext == ".jpe" || ext == ".bmp") {
+    std::vector<std::uint8_t> data =
+        to_rgb8(queue, img, spec.srgb, spec.dither);
+    if (ext == ".png") {
+      ret = png::write(path, img.size[0], img.size[1], data.data(),
+                       spec.compression);
+    } else if (ext == ".bmp") {
+      ret = (stbi_write_bmp(path.c_str(), static_cast<int>(img.size[0]),
+                            static_cast<int>(img.size[1]), static_cast<int>(3),
+                            data.data()) != 0);
+    } else {
+      ret = (stbi_write_jpg(path.c_str(), static_cast<int>(img.size[0]),
+                            static_cast<int>(img.size[1]), static_cast<int>(3),
+                            data.data(), 100) != 0);
+    }
+  } else {
+    LWARN("Unknown image format \"{}\", skipping image write", ext.string());
   }
 
+  if (!ret)
+    return IMG_WRITE_ERR;
   return OK;
 }
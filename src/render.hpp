@@ -1,14 +1,23 @@
 #ifndef RENDER_HPP_O0ZIUJK8
 #define RENDER_HPP_O0ZIUJK8
 
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <vector>
 
 #include <CL/sycl.hpp>
 
+#include "checkpoint.hpp"
+#include "dual.hpp"
 #include "exit_code.hpp"
+#include "mapped.hpp"
+#include "pixel.hpp"
+#include "pool.hpp"
 #include "scene.hpp"
+#include "sdf.hpp"
 
 namespace tpm {
 
@@ -22,6 +31,31 @@ inline std::uint32_t lcg_step(std::uint32_t z, std::uint32_t a,
                               std::uint32_t c) {
   return (a * z + c);
 }
+inline std::uint32_t hash_step(std::uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  return x ^ (x >> 16);
+}
+// Expands a key into a full generator state. The three Tausworthe
+// components need values above 1, 7 and 15 to avoid degenerate cycles.
+inline cl::sycl::uint4 seed_state(const std::uint32_t &key) {
+  return cl::sycl::uint4(hash_step(key ^ 0x1b873593u) | 0x80u,
+                         hash_step(key ^ 0xcc9e2d51u) | 0x80u,
+                         hash_step(key ^ 0xe6546b64u) | 0x80u,
+                         hash_step(key ^ 0x85ebca6bu));
+}
+// Every progressive pass of a tile starts from its own state, a function of
+// the tile seed and the pass index only, so a range of passes draws the same
+// samples in whichever process and order it is rendered. Pass 0 keeps the
+// tile seed, matching a single-pass render.
+inline cl::sycl::uint4 pass_seed(const cl::sycl::uint4 &tile,
+                                 const std::uint32_t &pass) {
+  if (pass == 0)
+    return tile;
+  return seed_state(hash_step(tile[0] ^ hash_step(tile[3] + pass)));
+}
 inline float random(cl::sycl::uint4 &state) {
   state[0] = taus_step(state[0], 13, 19, 12, 4294967294);
   state[1] = taus_step(state[1], 2, 25, 4, 4294967288);
@@ -34,11 +68,31 @@ inline float random(cl::sycl::uint4 &state) {
 
 struct Image {
   Image(const std::uint32_t &width, const std::uint32_t &height,
-        const std::uint32_t &tile_size = 32)
-      : size(width, height, tile_size), buffer(width * height) {}
-  Image(const cl::sycl::uint3 &size) : size(size), buffer() {}
-  Image(const cl::sycl::uint3 &size, std::vector<cl::sycl::float3> &buffer)
-      : size(size), buffer(buffer) {}
+        const std::uint32_t &tile_size = 32,
+        const PixelFormat &format = RGB32F)
+      : size(width, height, tile_size), format(format),
+        buffer(static_cast<std::size_t>(width) * height *
+               pixel_words(format)) {}
+  Image(const cl::sycl::uint3 &size, const PixelFormat &format = RGB32F)
+      : size(size), format(format), buffer() {}
+
+  inline std::uint32_t *data() {
+    return words != nullptr ? words : buffer.data();
+  }
+  inline const std::uint32_t *data() const {
+    return words != nullptr ? words : buffer.data();
+  }
+  inline std::size_t word_count() const {
+    return static_cast<std::size_t>(size[0]) * size[1] * pixel_words(format);
+  }
+  inline cl::sycl::float3 get(const std::size_t &idx) const {
+    return load_pixel(format, data(), idx);
+  }
+  inline void set(const std::size_t &idx, const cl::sycl::float3 &v) {
+    std::uint32_t *ptr = data();
+    store_pixel(format, ptr, idx, v);
+  }
+  inline PixelView view() const { return PixelView{data(), format}; }
 
   inline cl::sycl::uint4 tile(const cl::sycl::uint2 &id) const {
     std::uint32_t x = id[0] * size[2], y = id[1] * size[2];
@@ -68,24 +122,128 @@ struct Image {
   }
 
   cl::sycl::uint3 size;
-  std::vector<cl::sycl::float3> buffer;
+  PixelFormat format;
+  std::vector<std::uint32_t> buffer;
+  std::uint32_t *words = nullptr;
+  std::unique_ptr<MappedFile> mapping;
+};
+
+struct Aovs {
+  cl::sycl::float3 beauty, normal;
+  float depth, material, steps;
 };
 
-float eval_sdf(
-    const cl::sycl::float3 &p, const std::size_t &id,
-    const cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> &sdf,
-    std::size_t &mat);
-cl::sycl::float3
-ray_march(const cl::sycl::float3 &p, const cl::sycl::float3 &d,
-          const cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> &sdfs,
-          const cl::sycl::accessor<Mat, 1, cl::sycl::access::mode::read> &mats);
-cl::sycl::float3 render_pixel(
-    const cl::sycl::uint4 &pixel, cl::sycl::uint4 &seed,
-    const cl::sycl::accessor<Sdf, 1, cl::sycl::access::mode::read> &sdfs,
-    const cl::sycl::accessor<Mat, 1, cl::sycl::access::mode::read> &mats);
-ExitCode render_frame(const TpmSpec &spec);
-
-ExitCode write(const std::filesystem::path &path, const Image &img);
+inline cl::sycl::float3 aov_value(const Aovs &aovs, const AovType &type) {
+  switch (type) {
+  case DEPTH:
+    return cl::sycl::float3(aovs.depth, aovs.depth, aovs.depth);
+  case NORMAL:
+    return aovs.normal;
+  case MATERIAL:
+    return cl::sycl::float3(aovs.material, aovs.material, aovs.material);
+  case STEPS:
+    return cl::sycl::float3(aovs.steps, aovs.steps, aovs.steps);
+  case BEAUTY:
+  default:
+    return aovs.beauty;
+  }
+}
+
+// A read-only view of one of a renderer's host mirrors with the interface
+// of a read accessor, so the functions below also run on plain host threads.
+template <typename T> struct HostView {
+  const T &operator[](const std::size_t &i) const { return data[i]; }
+  std::size_t get_count() const { return count; }
+  const T *data;
+  std::size_t count;
+};
+
+template <typename V, typename Sdfs>
+sdf::scalar_t<V> eval_sdf(const V &p, const std::size_t &id, const Sdfs &sdf,
+                          std::size_t &mat);
+template <typename Sdfs, typename Mats>
+cl::sycl::float3 ray_march(const cl::sycl::float3 &p,
+                           const cl::sycl::float3 &d, const std::size_t &root,
+                           const Sdfs &sdfs, const Mats &mats, Aovs &aovs);
+template <typename Sdfs>
+float soft_shadow(const cl::sycl::float3 &p, const cl::sycl::float3 &d,
+                  const float &min_t, const float &max_t, const float &k,
+                  const Sdfs &sdfs);
+template <typename Sdfs>
+float ambient_occlusion(const cl::sycl::float3 &p, const cl::sycl::float3 &n,
+                        const Sdfs &sdfs);
+template <typename Sdfs, typename Mats, typename Lights>
+cl::sycl::float3 preview_march(const cl::sycl::float3 &p,
+                               const cl::sycl::float3 &d,
+                               const std::size_t &root, const float &k,
+                               const Sdfs &sdfs, const Mats &mats,
+                               const Lights &lights, Aovs &aovs);
+template <typename Sdfs, typename Mats, typename Lights>
+Aovs render_pixel(const cl::sycl::uint4 &pixel, cl::sycl::uint4 &seed,
+                  const std::size_t &root, const RendererSpec &renderer,
+                  const std::uint32_t &aov_mask, const Sdfs &sdfs,
+                  const Mats &mats, const Lights &lights);
+
+struct TileSlot {
+  std::size_t offset, capacity;
+};
+
+struct Renderer {
+  Renderer(const TpmSpec &spec,
+           const cl::sycl::queue &queue = cl::sycl::queue());
+
+  ExitCode restore(const std::filesystem::path &path);
+  void build(std::vector<Sdf> nodes);
+  void update(const std::uint32_t &frame);
+  std::uint32_t passes() const;
+  void render_pass(const std::uint32_t &pass, const std::uint32_t &first,
+                   cl::sycl::buffer<cl::sycl::float3> &accum_buffer,
+                   const std::array<AovType, max_outputs> &aovs,
+                   const std::uint32_t &aov_mask,
+                   const std::size_t &output_count);
+  std::uint32_t accumulate(const std::uint32_t &frame,
+                           const std::chrono::steady_clock::time_point &start,
+                           cl::sycl::buffer<cl::sycl::float3> &accum_buffer,
+                           const std::array<AovType, max_outputs> &aovs,
+                           const std::uint32_t &aov_mask,
+                           const std::size_t &output_count);
+  void render_tiles(const std::uint32_t &frame,
+                    const std::vector<std::uint32_t> &tiles,
+                    std::vector<cl::sycl::float3> &out,
+                    const std::vector<int> &cpus = {});
+  void render_passes(const std::uint32_t &frame, const std::uint32_t &first,
+                     const std::uint32_t &count,
+                     std::vector<cl::sycl::float3> &out);
+  ExitCode render(const std::uint32_t &frame, WritePool &pool,
+                  const std::vector<cl::sycl::float3> *gathered = nullptr);
+  ExitCode render_sequence(WritePool &pool);
+
+  TpmSpec spec;
+  cl::sycl::uint3 img_size;
+  cl::sycl::uint2 tile_size;
+  std::vector<Light> lights;
+  std::size_t base = 0, tail = 0;
+  std::vector<Sdf> sdfs;
+  std::vector<Mat> mats;
+  std::vector<TileSlot> slots;
+  std::vector<std::size_t> parents;
+  std::vector<std::size_t> roots;
+  std::vector<cl::sycl::uint4> seeds;
+  cl::sycl::queue queue;
+  cl::sycl::buffer<cl::sycl::uint4> seeds_buffer;
+  cl::sycl::buffer<std::size_t> roots_buffer;
+  cl::sycl::buffer<Sdf> sdfs_buffer;
+  cl::sycl::buffer<Mat> mats_buffer;
+  cl::sycl::buffer<Light> lights_buffer;
+  std::shared_ptr<checkpoint::State> resume;
+  checkpoint::Writer checkpoints;
+};
+
+ExitCode render_frame(const TpmSpec &spec, WritePool &pool);
+
+ExitCode make_output_dir(const std::filesystem::path &path);
+ExitCode write(cl::sycl::queue &queue, const OutputSpec &spec,
+               const Image &img);
 } // namespace tpm
 
 #endif /* end of include guard: RENDER_HPP_O0ZIUJK8 */
@@ -1,16 +1,23 @@
 #include "scene.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <filesystem>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <string>
 #include <tuple>
 
+#include <fmt/format.h>
 #include <pugixml.hpp>
 
 #include "exit_code.hpp"
 #include "log.hpp"
 #include "prof.hpp"
+#include "video.hpp"
+
+constexpr float pi = 3.14159265358979f;
 
 cl::sycl::float3 tpm::parse_hex(const std::string &hex) {
   int r, g, b;
@@ -18,64 +25,446 @@ cl::sycl::float3 tpm::parse_hex(const std::string &hex) {
   return cl::sycl::float3(r / 255.0, g / 255.0, b / 255.0);
 }
 
+std::optional<tpm::Mat> tpm::parse_material(const pugi::xml_node &node) {
+  std::string type = node.name();
+  if (type == "emission") {
+    return Mat(MatType::EMISSION,
+               parse_hex(node.attribute("color").as_string()),
+               node.attribute("s").as_float());
+  } else if (type == "diffuse") {
+  } else if (type == "glass") {
+  } else if (type == "glossy") {
+  }
+  return std::nullopt;
+}
+
 std::size_t tpm::parse_mat(const pugi::xml_node &node, TpmSpec &spec) {
+  PFUNC(&node);
+  for (const pugi::xml_node child : node) {
+    std::optional<Mat> mat = parse_material(child);
+    if (!mat)
+      continue;
+    spec.mats.push_back(*mat);
+    std::string id = child.attribute("id").as_string();
+    if (!id.empty() && !spec.mat_ids.emplace(id, spec.mats.size() - 1).second)
+      LWARN("Duplicate material id \"{}\", keyframes will use the first", id);
+    return spec.mats.size() - 1;
+  }
+  return std::numeric_limits<std::size_t>::max();
+}
+
+void tpm::parse_lights(const pugi::xml_node &node, TpmSpec &spec) {
   PFUNC(&node);
   for (const pugi::xml_node child : node) {
     std::string type = child.name();
-    if (type == "emission") {
-      spec.mats.emplace_back(MatType::EMISSION,
-                             parse_hex(child.attribute("color").as_string()),
-                             child.attribute("s").as_float());
-      return spec.mats.size() - 1;
-    } else if (type == "diffuse") {
-    } else if (type == "glass") {
-    } else if (type == "glossy") {
+    cl::sycl::float3 pos(child.attribute("x").as_float(),
+                         child.attribute("y").as_float(),
+                         child.attribute("z").as_float());
+    cl::sycl::float3 color =
+        parse_hex(child.attribute("color").as_string("#FFFFFF")) *
+        child.attribute("s").as_float(1.0f);
+    if (type == "point") {
+      spec.lights.emplace_back(LightType::POINT, pos, color);
+    } else if (type == "directional") {
+      spec.lights.emplace_back(LightType::DIRECTIONAL,
+                               cl::sycl::normalize(pos), color);
+    } else {
+      LWARN("Unknown light type \"{}\", ignoring", type);
     }
   }
-  return std::numeric_limits<std::size_t>::max();
 }
 
-std::size_t tpm::parse_sphere(const pugi::xml_node &node, TpmSpec &spec) {
+tpm::IntegratorType tpm::parse_integrator(const std::string &name) {
+  if (name == "preview") {
+    return IntegratorType::PREVIEW;
+  } else if (name != "march") {
+    LWARN("Unknown integrator \"{}\", using \"march\"", name);
+  }
+  return IntegratorType::MARCH;
+}
+
+tpm::PixelFormat tpm::parse_format(const std::string &name) {
+  if (name == "rgba16f") {
+    return PixelFormat::RGBA16F;
+  } else if (name == "rgb9e5") {
+    return PixelFormat::RGB9E5;
+  } else if (name != "rgb32f") {
+    LWARN("Unknown framebuffer format \"{}\", using \"rgb32f\"", name);
+  }
+  return PixelFormat::RGB32F;
+}
+
+tpm::AovType tpm::parse_aov(const std::string &name) {
+  if (name == "depth") {
+    return AovType::DEPTH;
+  } else if (name == "normal") {
+    return AovType::NORMAL;
+  } else if (name == "material") {
+    return AovType::MATERIAL;
+  } else if (name == "steps") {
+    return AovType::STEPS;
+  } else if (name != "beauty") {
+    LWARN("Unknown output variable \"{}\", using \"beauty\"", name);
+  }
+  return AovType::BEAUTY;
+}
+
+int tpm::parse_compression(const int &level) {
+  if (level < -1 || level > 9) {
+    int clamped = std::clamp(level, -1, 9);
+    LWARN("Compression level {} is outside -1..9, using {}", level, clamped);
+    return clamped;
+  }
+  return level;
+}
+
+tpm::OutputSpec tpm::parse_output(const pugi::xml_node &node) {
+  return OutputSpec{
+      node.attribute("path").as_string("output.png"),
+      parse_aov(node.attribute("aov").as_string("beauty")),
+      node.attribute("srgb").as_bool(true),
+      node.attribute("dither").as_bool(false),
+      parse_compression(node.attribute("compression").as_int(6)),
+      node.attribute("stream").as_bool(true),
+      parse_format(node.attribute("format").as_string("rgb32f")),
+      node.attribute("fps").as_uint(24),
+      node.attribute("encoder").as_string(""),
+  };
+}
+
+cl::sycl::float4 tpm::parse_args(const pugi::xml_node &node,
+                                 const SdfType &type) {
+  switch (type) {
+  case SPHERE:
+    return cl::sycl::float4(node.attribute("r").as_float(), 0.0f, 0.0f, 0.0f);
+  case BOX:
+  case TRANSLATE:
+    return cl::sycl::float4(node.attribute("x").as_float(),
+                            node.attribute("y").as_float(),
+                            node.attribute("z").as_float(), 0.0f);
+  case ROUND_BOX:
+    return cl::sycl::float4(
+        node.attribute("x").as_float(), node.attribute("y").as_float(),
+        node.attribute("z").as_float(), node.attribute("r").as_float());
+  case TORUS:
+    return cl::sycl::float4(node.attribute("R").as_float(),
+                            node.attribute("r").as_float(), 0.0f, 0.0f);
+  case CAPSULE:
+  case CYLINDER:
+    return cl::sycl::float4(node.attribute("h").as_float(),
+                            node.attribute("r").as_float(), 0.0f, 0.0f);
+  case CONE:
+    return cl::sycl::float4(node.attribute("h").as_float(),
+                            node.attribute("r1").as_float(),
+                            node.attribute("r2").as_float(), 0.0f);
+  case PLANE: {
+    cl::sycl::float3 n(node.attribute("x").as_float(0.0f),
+                       node.attribute("y").as_float(1.0f),
+                       node.attribute("z").as_float(0.0f));
+    if (cl::sycl::length(n) == 0.0f) {
+      LWARN("Plane normal is zero, using 0 1 0");
+      n = cl::sycl::float3(0.0f, 1.0f, 0.0f);
+    }
+    return cl::sycl::float4(cl::sycl::normalize(n),
+                            node.attribute("d").as_float());
+  }
+  case ELLIPSOID:
+    return cl::sycl::float4(node.attribute("x").as_float(1.0f),
+                            node.attribute("y").as_float(1.0f),
+                            node.attribute("z").as_float(1.0f), 0.0f);
+  case ROTATE: {
+    cl::sycl::float3 axis(node.attribute("x").as_float(0.0f),
+                          node.attribute("y").as_float(1.0f),
+                          node.attribute("z").as_float(0.0f));
+    if (cl::sycl::length(axis) == 0.0f) {
+      LWARN("Rotation axis is zero, using 0 1 0");
+      axis = cl::sycl::float3(0.0f, 1.0f, 0.0f);
+    }
+    float angle = node.attribute("angle").as_float() * pi / 360.0f;
+    return cl::sycl::float4(cl::sycl::normalize(axis) * cl::sycl::sin(angle),
+                            cl::sycl::cos(angle));
+  }
+  case SCALE: {
+    float s = node.attribute("s").as_float(1.0f);
+    if (s == 0.0f || !std::isfinite(s)) {
+      LWARN("Scale factor {} can not be inverted, using 1", s);
+      s = 1.0f;
+    }
+    return cl::sycl::float4(s, 0.0f, 0.0f, 0.0f);
+  }
+  case TWIST:
+  case BEND:
+    return cl::sycl::float4(node.attribute("k").as_float(), 0.0f, 0.0f, 0.0f);
+  case ROUND:
+    return cl::sycl::float4(node.attribute("r").as_float(), 0.0f, 0.0f, 0.0f);
+  case ONION:
+    return cl::sycl::float4(node.attribute("t").as_float(), 0.0f, 0.0f, 0.0f);
+  case SMOOTH_UNION:
+  case SMOOTH_SUBTRACTION:
+    return cl::sycl::float4(node.attribute("k").as_float(0.1f), 0.0f, 0.0f,
+                            0.0f);
+  case UNION:
+  case INTERSECTION:
+  case SUBTRACTION:
+  default:
+    return cl::sycl::float4(0.0f);
+  }
+}
+
+std::size_t tpm::parse_primitive(const pugi::xml_node &node, TpmSpec &spec,
+                                 const SdfType &type,
+                                 const cl::sycl::float4 &args) {
   PFUNC(&node);
-  spec.sdfs.emplace_back(SdfType::SPHERE, node.attribute("r").as_float());
+  spec.sdfs.emplace_back(type, args);
   spec.sdfs.back().mat = parse_mat(node, spec);
+  parse_id(node, spec);
   return spec.sdfs.size() - 1;
 }
 
-std::size_t tpm::parse_translate(const pugi::xml_node &node, TpmSpec &spec) {
+std::size_t tpm::parse_unary(const pugi::xml_node &node, TpmSpec &spec,
+                             const SdfType &type,
+                             const cl::sycl::float4 &args) {
   PFUNC(&node);
-  spec.sdfs.emplace_back(SdfType::TRANSLATE, node.attribute("x").as_float(),
-                         node.attribute("y").as_float(),
-                         node.attribute("z").as_float());
+  spec.sdfs.emplace_back(type, args);
   std::size_t id = spec.sdfs.size() - 1;
+  parse_id(node, spec);
   spec.sdfs[id].a = parse_sdf(*node.begin(), spec);
   return id;
 }
 
-std::size_t tpm::parse_union(const pugi::xml_node &node, TpmSpec &spec) {
+std::size_t tpm::parse_binary(const pugi::xml_node &node, TpmSpec &spec,
+                              const SdfType &type,
+                              const cl::sycl::float4 &args) {
   PFUNC(&node);
-  spec.sdfs.emplace_back(SdfType::UNION);
+  spec.sdfs.emplace_back(type, args);
   std::size_t id = spec.sdfs.size() - 1;
+  parse_id(node, spec);
   spec.sdfs[id].a = parse_sdf(*node.begin(), spec);
   spec.sdfs[id].b = parse_sdf(*(++node.begin()), spec);
   return id;
 }
 
+std::size_t tpm::parse_sphere(const pugi::xml_node &node, TpmSpec &spec) {
+  return parse_primitive(node, spec, SdfType::SPHERE,
+                         parse_args(node, SdfType::SPHERE));
+}
+
+std::size_t tpm::parse_box(const pugi::xml_node &node, TpmSpec &spec) {
+  return parse_primitive(node, spec, SdfType::BOX,
+                         parse_args(node, SdfType::BOX));
+}
+
+std::size_t tpm::parse_plane(const pugi::xml_node &node, TpmSpec &spec) {
+  return parse_primitive(node, spec, SdfType::PLANE,
+                         parse_args(node, SdfType::PLANE));
+}
+
+std::size_t tpm::parse_translate(const pugi::xml_node &node, TpmSpec &spec) {
+  return parse_unary(node, spec, SdfType::TRANSLATE,
+                     parse_args(node, SdfType::TRANSLATE));
+}
+
+std::size_t tpm::parse_rotate(const pugi::xml_node &node, TpmSpec &spec) {
+  return parse_unary(node, spec, SdfType::ROTATE,
+                     parse_args(node, SdfType::ROTATE));
+}
+
+std::size_t tpm::parse_union(const pugi::xml_node &node, TpmSpec &spec) {
+  return parse_binary(node, spec, SdfType::UNION, cl::sycl::float4(0.0f));
+}
+
 std::size_t tpm::parse_sdf(const pugi::xml_node &node, TpmSpec &spec) {
   PFUNC(&node);
   std::string type = node.name();
   if (type == "sphere") {
     return parse_sphere(node, spec);
+  } else if (type == "box") {
+    return parse_box(node, spec);
+  } else if (type == "roundbox") {
+    return parse_primitive(node, spec, SdfType::ROUND_BOX,
+                           parse_args(node, SdfType::ROUND_BOX));
+  } else if (type == "torus") {
+    return parse_primitive(node, spec, SdfType::TORUS,
+                           parse_args(node, SdfType::TORUS));
+  } else if (type == "capsule") {
+    return parse_primitive(node, spec, SdfType::CAPSULE,
+                           parse_args(node, SdfType::CAPSULE));
+  } else if (type == "cylinder") {
+    return parse_primitive(node, spec, SdfType::CYLINDER,
+                           parse_args(node, SdfType::CYLINDER));
+  } else if (type == "cone") {
+    return parse_primitive(node, spec, SdfType::CONE,
+                           parse_args(node, SdfType::CONE));
+  } else if (type == "plane") {
+    return parse_plane(node, spec);
+  } else if (type == "ellipsoid") {
+    return parse_primitive(node, spec, SdfType::ELLIPSOID,
+                           parse_args(node, SdfType::ELLIPSOID));
   } else if (type == "translate") {
     return parse_translate(node, spec);
+  } else if (type == "rotate") {
+    return parse_rotate(node, spec);
+  } else if (type == "scale") {
+    return parse_unary(node, spec, SdfType::SCALE,
+                       parse_args(node, SdfType::SCALE));
+  } else if (type == "twist") {
+    return parse_unary(node, spec, SdfType::TWIST,
+                       parse_args(node, SdfType::TWIST));
+  } else if (type == "bend") {
+    return parse_unary(node, spec, SdfType::BEND,
+                       parse_args(node, SdfType::BEND));
+  } else if (type == "round") {
+    return parse_unary(node, spec, SdfType::ROUND,
+                       parse_args(node, SdfType::ROUND));
+  } else if (type == "onion") {
+    return parse_unary(node, spec, SdfType::ONION,
+                       parse_args(node, SdfType::ONION));
   } else if (type == "union") {
     return parse_union(node, spec);
+  } else if (type == "intersection") {
+    return parse_binary(node, spec, SdfType::INTERSECTION,
+                        parse_args(node, SdfType::INTERSECTION));
+  } else if (type == "subtraction") {
+    return parse_binary(node, spec, SdfType::SUBTRACTION,
+                        parse_args(node, SdfType::SUBTRACTION));
+  } else if (type == "smoothunion") {
+    return parse_binary(node, spec, SdfType::SMOOTH_UNION,
+                        parse_args(node, SdfType::SMOOTH_UNION));
+  } else if (type == "smoothsubtraction") {
+    return parse_binary(node, spec, SdfType::SMOOTH_SUBTRACTION,
+                        parse_args(node, SdfType::SMOOTH_SUBTRACTION));
   } else {
     LWARN("Unknown node type \"{}\", ignoring", type);
     return std::numeric_limits<std::size_t>::max();
   }
 }
 
+void tpm::parse_id(const pugi::xml_node &node, TpmSpec &spec) {
+  std::string id = node.attribute("id").as_string();
+  if (!id.empty() && !spec.ids.emplace(id, spec.sdfs.size() - 1).second)
+    LWARN("Duplicate node id \"{}\", keyframes will use the first", id);
+}
+
+template <typename K> static void sort_keys(std::vector<K> &keys) {
+  std::stable_sort(keys.begin(), keys.end(), [](const K &lhs, const K &rhs) {
+    return lhs.target != rhs.target ? lhs.target < rhs.target
+                                    : lhs.frame < rhs.frame;
+  });
+}
+
+template <typename K, typename F>
+static void interpolate_keys(const std::vector<K> &keys,
+                             const std::uint32_t &frame, F &&apply) {
+  for (std::size_t i = 0, end = 0; i < keys.size(); i = end) {
+    for (end = i; end < keys.size() && keys[end].target == keys[i].target;
+         ++end)
+      ;
+    std::size_t j = i;
+    while (j + 1 < end && keys[j + 1].frame <= frame)
+      ++j;
+    if (keys[j].frame < frame && j + 1 < end)
+      apply(keys[j], &keys[j + 1],
+            static_cast<float>(frame - keys[j].frame) /
+                static_cast<float>(keys[j + 1].frame - keys[j].frame));
+    else
+      apply(keys[j], nullptr, 0.0f);
+  }
+}
+
+void tpm::parse_sequence(const pugi::xml_node &node,
+                         const pugi::xml_node &scene, TpmSpec &spec) {
+  PFUNC(&node);
+  spec.sequence.start = node.attribute("start").as_uint(0);
+  spec.sequence.end = node.attribute("end").as_uint(spec.sequence.start);
+  if (spec.sequence.end < spec.sequence.start) {
+    LWARN("Sequence ends before it starts, rendering frame {} only",
+          spec.sequence.start);
+    spec.sequence.end = spec.sequence.start;
+  }
+
+  for (pugi::xml_node key : node.children("key")) {
+    std::string target = key.attribute("target").as_string();
+    auto id = spec.ids.find(target);
+    auto mat = spec.mat_ids.find(target);
+    pugi::xml_node source = scene.find_node([&](const pugi::xml_node &n) {
+      return target == n.attribute("id").as_string();
+    });
+    if ((id == spec.ids.end() && mat == spec.mat_ids.end()) || !source) {
+      LWARN("Keyframe target \"{}\" does not exist, ignoring", target);
+      continue;
+    }
+
+    pugi::xml_document scratch;
+    pugi::xml_node merged = scratch.append_child(source.name());
+    for (pugi::xml_attribute attr : source.attributes())
+      merged.append_attribute(attr.name()) = attr.value();
+    for (pugi::xml_attribute attr : key.attributes()) {
+      std::string name = attr.name();
+      if (name == "target" || name == "frame")
+        continue;
+      if (!merged.attribute(attr.name()))
+        merged.append_attribute(attr.name());
+      merged.attribute(attr.name()) = attr.value();
+    }
+    std::uint32_t frame = key.attribute("frame").as_uint();
+    if (id != spec.ids.end()) {
+      spec.sequence.keys.push_back(Keyframe{
+          id->second, frame, parse_args(merged, spec.sdfs[id->second].type)});
+    } else {
+      Mat values = parse_material(merged).value_or(spec.mats[mat->second]);
+      spec.sequence.mat_keys.push_back(
+          MatKeyframe{mat->second, frame, values.color, values.args});
+    }
+  }
+  sort_keys(spec.sequence.keys);
+  sort_keys(spec.sequence.mat_keys);
+}
+
+std::vector<tpm::Sdf> tpm::frame_sdfs(const TpmSpec &spec,
+                                      const std::uint32_t &frame) {
+  std::vector<Sdf> sdfs = spec.sdfs;
+  interpolate_keys(spec.sequence.keys, frame,
+                   [&](const Keyframe &lhs, const Keyframe *rhs, float t) {
+                     Sdf &node = sdfs[lhs.target];
+                     node.args = lhs.args;
+                     if (rhs == nullptr)
+                       return;
+                     node.args = lhs.args + (rhs->args - lhs.args) * t;
+                     if (node.type == ROTATE)
+                       node.args = cl::sycl::normalize(node.args);
+                   });
+  return sdfs;
+}
+
+std::vector<tpm::Mat> tpm::frame_mats(const TpmSpec &spec,
+                                      const std::uint32_t &frame) {
+  std::vector<Mat> mats = spec.mats;
+  interpolate_keys(spec.sequence.mat_keys, frame,
+                   [&](const MatKeyframe &lhs, const MatKeyframe *rhs,
+                       float t) {
+                     Mat &mat = mats[lhs.target];
+                     mat.color = lhs.color;
+                     mat.args = lhs.args;
+                     if (rhs == nullptr)
+                       return;
+                     mat.color = lhs.color + (rhs->color - lhs.color) * t;
+                     mat.args = lhs.args + (rhs->args - lhs.args) * t;
+                   });
+  return mats;
+}
+
+std::string tpm::frame_path(const std::string &path,
+                            const std::uint32_t &frame) {
+  std::size_t last = path.find_last_of('#');
+  if (last == std::string::npos)
+    return path;
+  std::size_t first = path.find_last_not_of('#', last);
+  first = first == std::string::npos ? 0 : first + 1;
+  return path.substr(0, first) +
+         fmt::format("{:0{}}", frame, last - first + 1) +
+         path.substr(last + 1);
+}
+
 std::pair<tpm::ExitCode, tpm::TpmSpec>
 tpm::parse_spec(const std::string &path) {
   PFUNC(path);
@@ -92,6 +481,24 @@ tpm::parse_spec(const std::string &path) {
     LERR("Failed to parse scene file \"{}\"", path);
     return std::make_pair(SCENE_PARSE_ERROR, std::move(tpm_spec));
   }
+  return parse_document(doc, path);
+}
+
+std::pair<tpm::ExitCode, tpm::TpmSpec>
+tpm::parse_spec_string(const std::string &xml) {
+  PFUNC(xml.size());
+
+  pugi::xml_document doc;
+  if (!doc.load_buffer(xml.data(), xml.size())) {
+    LERR("Failed to parse inline scene description");
+    return std::make_pair(SCENE_PARSE_ERROR, TpmSpec());
+  }
+  return parse_document(doc, "<inline>");
+}
+
+std::pair<tpm::ExitCode, tpm::TpmSpec>
+tpm::parse_document(const pugi::xml_document &doc, const std::string &path) {
+  TpmSpec tpm_spec;
 
   const pugi::xml_node root = doc.child("tpm");
   if (!root) {
@@ -104,20 +511,55 @@ tpm::parse_spec(const std::string &path) {
   pugi::xml_node image = root.child("image");
   if (image) {
     tpm_spec.image = ImageSpec{
-        image.attribute("path").as_string("output.png"),
         image.attribute("width").as_uint(1920),
         image.attribute("height").as_uint(1080),
         image.attribute("tileSize").as_uint(32),
+        {},
     };
+    if (image.attribute("path") || !image.child("output"))
+      tpm_spec.image.outputs.push_back(parse_output(image));
+    for (pugi::xml_node output : image.children("output"))
+      tpm_spec.image.outputs.push_back(parse_output(output));
+    if (tpm_spec.image.outputs.size() > max_outputs) {
+      LWARN("Only {} outputs are supported, ignoring the remaining {}",
+            max_outputs, tpm_spec.image.outputs.size() - max_outputs);
+      tpm_spec.image.outputs.resize(max_outputs);
+    }
   }
 
   pugi::xml_node renderer = root.child("renderer");
   if (renderer) {
     tpm_spec.renderer = RendererSpec{
-        image.attribute("spp").as_ullong(64),
+        renderer.attribute("spp").as_ullong(64),
+        parse_integrator(renderer.attribute("integrator").as_string("march")),
+        renderer.attribute("shadowK").as_float(16.0f),
+        renderer.attribute("prune").as_bool(true),
+        renderer.attribute("cores").as_uint(0),
+        renderer.attribute("budget").as_uint(0),
+        renderer.attribute("seed")
+            ? std::optional<std::uint32_t>(renderer.attribute("seed").as_uint())
+            : std::nullopt,
     };
   }
 
+  pugi::xml_node device = root.child("device");
+  if (device) {
+    tpm_spec.device.select = device.attribute("select").as_string();
+    tpm_spec.device.multi = device.attribute("multi").as_bool(false);
+  }
+
+  pugi::xml_node checkpoint = root.child("checkpoint");
+  if (checkpoint) {
+    tpm_spec.checkpoint.path = checkpoint.attribute("path").as_string();
+    tpm_spec.checkpoint.interval =
+        checkpoint.attribute("interval").as_uint(300);
+  }
+
+  pugi::xml_node lights = root.child("lights");
+  if (lights) {
+    parse_lights(lights, tpm_spec);
+  }
+
   pugi::xml_node scene = root.child("scene");
   if (scene) {
     parse_sdf(*scene.begin(), tpm_spec);
@@ -126,5 +568,18 @@ tpm::parse_spec(const std::string &path) {
     return std::make_pair(SCENE_MISSING, std::move(tpm_spec));
   }
 
+  pugi::xml_node sequence = root.child("sequence");
+  if (sequence)
+    parse_sequence(sequence, scene, tpm_spec);
+  if (tpm_spec.sequence.end > tpm_spec.sequence.start) {
+    for (const OutputSpec &output : tpm_spec.image.outputs) {
+      if (output.path.find('#') == std::string::npos &&
+          !video::is_video(output.path))
+        LWARN("Output \"{}\" has no '#' frame number, each frame of the "
+              "sequence will overwrite it",
+              output.path);
+    }
+  }
+
   return std::make_pair(OK, std::move(tpm_spec));
 }
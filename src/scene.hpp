@@ -1,8 +1,10 @@
 #ifndef SCENE_HPP_RZWYUXDC
 #define SCENE_HPP_RZWYUXDC
 
+#include <map>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <CL/sycl.hpp>
 #include <pugixml.hpp>
@@ -11,8 +13,36 @@
 
 namespace tpm {
 
-enum SdfType { SPHERE, TRANSLATE, UNION };
+enum SdfType {
+  SPHERE,
+  BOX,
+  ROUND_BOX,
+  TORUS,
+  CAPSULE,
+  CYLINDER,
+  CONE,
+  PLANE,
+  ELLIPSOID,
+  TRANSLATE,
+  ROTATE,
+  SCALE,
+  TWIST,
+  BEND,
+  ROUND,
+  ONION,
+  UNION,
+  INTERSECTION,
+  SUBTRACTION,
+  SMOOTH_UNION,
+  SMOOTH_SUBTRACTION
+};
 enum MatType { NONE, EMISSION, DIFFUSE, GLASS, GLOSSY };
+enum LightType { POINT, DIRECTIONAL };
+enum IntegratorType { MARCH, PREVIEW };
+enum PixelFormat { RGB32F, RGBA16F, RGB9E5 };
+enum AovType { BEAUTY, DEPTH, NORMAL, MATERIAL, STEPS };
+
+constexpr std::size_t max_outputs = 8;
 
 struct Mat {
   Mat(const MatType &type, const cl::sycl::float3 &color,
@@ -26,6 +56,16 @@ struct Mat {
   cl::sycl::float2 args;
 };
 
+struct Light {
+  Light(const LightType &type, const cl::sycl::float3 &pos,
+        const cl::sycl::float3 &color)
+      : type(type), pos(pos), color(color) {}
+
+  LightType type;
+  cl::sycl::float3 pos;
+  cl::sycl::float3 color;
+};
+
 struct Sdf {
   Sdf(const SdfType &type, const cl::sycl::float4 &args)
       : type(type), args(args), mat(std::numeric_limits<std::size_t>::max()),
@@ -52,30 +92,103 @@ struct Sdf {
   std::size_t mat, a, b;
 };
 
-struct ImageSpec {
+struct OutputSpec {
   std::string path = "output.png";
+  AovType aov = BEAUTY;
+  bool srgb = true, dither = false;
+  int compression = 6;
+  bool stream = true;
+  PixelFormat format = RGB32F;
+  std::uint32_t fps = 24;
+  std::string encoder = "";
+};
+struct ImageSpec {
   std::uint32_t width = 1920, height = 1080, tile = 32;
+  std::vector<OutputSpec> outputs = {OutputSpec{}};
 };
 struct RendererSpec {
   std::size_t spp = 64;
+  IntegratorType integrator = MARCH;
+  float shadow_k = 16.0f;
+  bool prune = true;
+  std::uint32_t cores = 0;
+  std::uint32_t budget = 0;
+  std::optional<std::uint32_t> seed;
+};
+struct Keyframe {
+  std::size_t target;
+  std::uint32_t frame;
+  cl::sycl::float4 args;
+};
+struct MatKeyframe {
+  std::size_t target;
+  std::uint32_t frame;
+  cl::sycl::float3 color;
+  cl::sycl::float2 args;
+};
+struct SequenceSpec {
+  std::uint32_t start = 0, end = 0;
+  std::vector<Keyframe> keys;
+  std::vector<MatKeyframe> mat_keys;
+};
+struct DeviceSpec {
+  std::string select;
+  bool multi = false;
+};
+struct CheckpointSpec {
+  std::string path, resume;
+  std::uint32_t interval = 300;
 };
 struct TpmSpec {
   ImageSpec image;
   RendererSpec renderer;
+  SequenceSpec sequence;
+  CheckpointSpec checkpoint;
+  DeviceSpec device;
   std::vector<Sdf> sdfs;
   std::vector<Mat> mats;
+  std::vector<Light> lights;
+  std::map<std::string, std::size_t> ids, mat_ids;
 };
 
 cl::sycl::float3 parse_hex(const std::string &hex);
+std::optional<Mat> parse_material(const pugi::xml_node &node);
 std::size_t parse_mat(const pugi::xml_node &node, TpmSpec &spec);
+void parse_lights(const pugi::xml_node &node, TpmSpec &spec);
+IntegratorType parse_integrator(const std::string &name);
+PixelFormat parse_format(const std::string &name);
+AovType parse_aov(const std::string &name);
+int parse_compression(const int &level);
+OutputSpec parse_output(const pugi::xml_node &node);
+cl::sycl::float4 parse_args(const pugi::xml_node &node, const SdfType &type);
+void parse_id(const pugi::xml_node &node, TpmSpec &spec);
+void parse_sequence(const pugi::xml_node &node, const pugi::xml_node &scene,
+                    TpmSpec &spec);
+
+std::size_t parse_primitive(const pugi::xml_node &node, TpmSpec &spec,
+                            const SdfType &type, const cl::sycl::float4 &args);
+std::size_t parse_unary(const pugi::xml_node &node, TpmSpec &spec,
+                        const SdfType &type, const cl::sycl::float4 &args);
+std::size_t parse_binary(const pugi::xml_node &node, TpmSpec &spec,
+                         const SdfType &type, const cl::sycl::float4 &args);
 
 std::size_t parse_sphere(const pugi::xml_node &node, TpmSpec &spec);
+std::size_t parse_box(const pugi::xml_node &node, TpmSpec &spec);
+std::size_t parse_plane(const pugi::xml_node &node, TpmSpec &spec);
 
 std::size_t parse_translate(const pugi::xml_node &node, TpmSpec &spec);
+std::size_t parse_rotate(const pugi::xml_node &node, TpmSpec &spec);
 std::size_t parse_union(const pugi::xml_node &node, TpmSpec &spec);
 
 std::size_t parse_sdf(const pugi::xml_node &node, TpmSpec &spec);
 std::pair<ExitCode, TpmSpec> parse_spec(const std::string &path);
+std::pair<ExitCode, TpmSpec> parse_spec_string(const std::string &xml);
+std::pair<ExitCode, TpmSpec> parse_document(const pugi::xml_document &doc,
+                                            const std::string &path);
+
+std::vector<Sdf> frame_sdfs(const TpmSpec &spec, const std::uint32_t &frame);
+std::vector<Mat> frame_mats(const TpmSpec &spec, const std::uint32_t &frame);
+std::string frame_path(const std::string &path, const std::uint32_t &frame);
 } // namespace tpm
 
 #endif /* end of include guard: SCENE_HPP_RZWYUXDC */
@@ -1,29 +1,173 @@
 #ifndef SDF_HPP_OAMZXL8I
 #define SDF_HPP_OAMZXL8I
 
+#include <type_traits>
+#include <utility>
+
 #include <CL/sycl.hpp>
 
 namespace tpm::sdf {
+using cl::sycl::clamp;
+using cl::sycl::cos;
+using cl::sycl::dot;
+using cl::sycl::fabs;
+using cl::sycl::length;
+using cl::sycl::max;
+using cl::sycl::min;
+using cl::sycl::sign;
+using cl::sycl::sin;
+using cl::sycl::sqrt;
+
+template <typename V>
+using scalar_t = std::decay_t<decltype(std::declval<const V &>()[0])>;
+
 inline float dot2(const cl::sycl::float2 &v) { return cl::sycl::dot(v, v); }
 inline float dot2(const cl::sycl::float3 &v) { return cl::sycl::dot(v, v); }
 inline float ndot(const cl::sycl::float2 &a, const cl::sycl::float2 &b) {
   return a[0] * b[0] - a[1] * b[1];
 }
-inline float sphere(const cl::sycl::float3 &p, const float &s) {
-  return cl::sycl::length(p) - s;
+template <typename T> inline T sqr(const T &a) { return a * a; }
+template <typename T> inline T length2(const T &x, const T &y) {
+  return sqrt(sqr(x) + sqr(y));
+}
+template <typename T> inline T length3(const T &x, const T &y, const T &z) {
+  return sqrt(sqr(x) + sqr(y) + sqr(z));
+}
+
+template <typename V>
+inline scalar_t<V> sphere(const V &p, const float &s) {
+  return length(p) - s;
+}
+template <typename V>
+inline scalar_t<V> box(const V &p, const cl::sycl::float3 &b) {
+  V q = fabs(p) - b;
+  return length(max(q, scalar_t<V>(0.0f))) +
+         min(max(q[0], max(q[1], q[2])), scalar_t<V>(0.0f));
 }
-inline float box(const cl::sycl::float3 &p, const cl::sycl::float3 &b) {
+inline cl::sycl::float3 sphere_grad(const cl::sycl::float3 &p, const float &) {
+  float l = cl::sycl::length(p);
+  return l > 0.0f ? p / l : cl::sycl::float3(0.0f, 1.0f, 0.0f);
+}
+inline cl::sycl::float3 box_grad(const cl::sycl::float3 &p,
+                                 const cl::sycl::float3 &b) {
   cl::sycl::float3 q = cl::sycl::fabs(p) - b;
-  return cl::sycl::length(cl::sycl::max(q, cl::sycl::float3(0.0, 0.0, 0.0))) +
-         cl::sycl::min(cl::sycl::max(q[0], cl::sycl::max(q[1], q[2])), 0.0f);
+  cl::sycl::float3 s(p[0] < 0.0f ? -1.0f : 1.0f, p[1] < 0.0f ? -1.0f : 1.0f,
+                     p[2] < 0.0f ? -1.0f : 1.0f);
+  cl::sycl::float3 o = cl::sycl::max(q, cl::sycl::float3(0.0f, 0.0f, 0.0f));
+  float l = cl::sycl::length(o);
+  if (l > 0.0f)
+    return s * o / l;
+  if (q[0] > q[1] && q[0] > q[2])
+    return cl::sycl::float3(s[0], 0.0f, 0.0f);
+  if (q[1] > q[2])
+    return cl::sycl::float3(0.0f, s[1], 0.0f);
+  return cl::sycl::float3(0.0f, 0.0f, s[2]);
+}
+template <typename V>
+inline scalar_t<V> round_box(const V &p, const cl::sycl::float3 &b,
+                             const float &r) {
+  return box(p, b - r) - r;
+}
+template <typename V>
+inline scalar_t<V> torus(const V &p, const float &major, const float &minor) {
+  return length2(length2(p[0], p[2]) - major, p[1]) - minor;
+}
+template <typename V>
+inline scalar_t<V> capsule(const V &p, const float &h, const float &r) {
+  return length3(p[0], p[1] - clamp(p[1], scalar_t<V>(-h), scalar_t<V>(h)),
+                 p[2]) -
+         r;
+}
+template <typename V>
+inline scalar_t<V> cylinder(const V &p, const float &h, const float &r) {
+  using T = scalar_t<V>;
+  T dx = length2(p[0], p[2]) - r, dy = fabs(p[1]) - h;
+  return min(max(dx, dy), T(0.0f)) +
+         length2(max(dx, T(0.0f)), max(dy, T(0.0f)));
+}
+template <typename V>
+inline scalar_t<V> cone(const V &p, const float &h, const float &r1,
+                        const float &r2) {
+  using T = scalar_t<V>;
+  T qx = length2(p[0], p[2]), qy = p[1];
+  T r = r2 + (r1 - r2) * (0.5f - 0.5f * sign(qy));
+  T ca_x = qx - min(qx, r), ca_y = fabs(qy) - h;
+  float k_x = r2 - r1, k_y = 2.0f * h;
+  T t = clamp(((r2 - qx) * k_x + (h - qy) * k_y) / (k_x * k_x + k_y * k_y),
+              T(0.0f), T(1.0f));
+  T cb_x = qx - r2 + k_x * t, cb_y = qy - h + k_y * t;
+  return sign(max(cb_x, ca_y)) *
+         sqrt(min(sqr(ca_x) + sqr(ca_y), sqr(cb_x) + sqr(cb_y)));
+}
+template <typename V>
+inline scalar_t<V> plane(const V &p, const cl::sycl::float3 &n,
+                         const float &d) {
+  return p[0] * n[0] + p[1] * n[1] + p[2] * n[2] + d;
+}
+template <typename V>
+inline scalar_t<V> ellipsoid(const V &p, const cl::sycl::float3 &r) {
+  using T = scalar_t<V>;
+  T k0 = length3(p[0] / r[0], p[1] / r[1], p[2] / r[2]);
+  T k1 = length3(p[0] / (r[0] * r[0]), p[1] / (r[1] * r[1]),
+                 p[2] / (r[2] * r[2]));
+  return k0 * (k0 - 1.0f) / k1;
 }
 
-inline cl::sycl::float3 op_translate(const cl::sycl::float3 &p,
-                                  const cl::sycl::float3 &t) {
+template <typename V>
+inline V op_translate(const V &p, const cl::sycl::float3 &t) {
   return p - t;
 }
-inline float op_union(const float &a, const float &b) {
-  return cl::sycl::min(a, b);
+template <typename V>
+inline V op_rotate(const V &p, const cl::sycl::float4 &q) {
+  float x = q[0], y = q[1], z = q[2], w = q[3];
+  return V(p[0] * (1.0f - 2.0f * (y * y + z * z)) +
+               p[1] * (2.0f * (x * y + w * z)) +
+               p[2] * (2.0f * (x * z - w * y)),
+           p[0] * (2.0f * (x * y - w * z)) +
+               p[1] * (1.0f - 2.0f * (x * x + z * z)) +
+               p[2] * (2.0f * (y * z + w * x)),
+           p[0] * (2.0f * (x * z + w * y)) +
+               p[1] * (2.0f * (y * z - w * x)) +
+               p[2] * (1.0f - 2.0f * (x * x + y * y)));
+}
+template <typename V> inline V op_scale(const V &p, const float &s) {
+  return V(p[0] / s, p[1] / s, p[2] / s);
+}
+template <typename V> inline V op_twist(const V &p, const float &k) {
+  using T = scalar_t<V>;
+  T c = cos(p[1] * k), s = sin(p[1] * k);
+  return V(c * p[0] - s * p[2], p[1], s * p[0] + c * p[2]);
+}
+template <typename V> inline V op_bend(const V &p, const float &k) {
+  using T = scalar_t<V>;
+  T c = cos(p[0] * k), s = sin(p[0] * k);
+  return V(c * p[0] - s * p[1], s * p[0] + c * p[1], p[2]);
+}
+
+template <typename T> inline T op_union(const T &a, const T &b) {
+  return min(a, b);
+}
+template <typename T> inline T op_intersection(const T &a, const T &b) {
+  return max(a, b);
+}
+template <typename T> inline T op_subtraction(const T &a, const T &b) {
+  return max(a, -b);
+}
+template <typename T>
+inline T op_smooth_union(const T &a, const T &b, const float &k) {
+  T h = clamp(0.5f + 0.5f * (b - a) / k, T(0.0f), T(1.0f));
+  return b + (a - b) * h - k * h * (1.0f - h);
+}
+template <typename T>
+inline T op_smooth_subtraction(const T &a, const T &b, const float &k) {
+  T h = clamp(0.5f - 0.5f * (a + b) / k, T(0.0f), T(1.0f));
+  return a - (a + b) * h + k * h * (1.0f - h);
+}
+template <typename T> inline T op_round(const T &d, const float &r) {
+  return d - r;
+}
+template <typename T> inline T op_onion(const T &d, const float &t) {
+  return fabs(d) - t;
 }
 } // namespace tpm::sdf
 
@@ -0,0 +1,440 @@
+#include "serve.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <CL/sycl.hpp>
+#include <fmt/format.h>
+
+#include "device.hpp"
+#include "exit_code.hpp"
+#include "log.hpp"
+#include "net.hpp"
+#include "pool.hpp"
+#include "prof.hpp"
+#include "render.hpp"
+#include "scene.hpp"
+
+constexpr std::size_t cache_size = 8;
+constexpr std::size_t max_scene_bytes = 64u << 20;
+constexpr int listen_backlog = 64;
+constexpr std::chrono::milliseconds poll_interval(250);
+constexpr long read_timeout_s = 10;
+constexpr std::size_t max_receiving = 16;
+constexpr std::chrono::seconds aging_step(10);
+constexpr std::chrono::seconds reserve_after(60);
+
+static volatile std::sig_atomic_t stop_requested = 0;
+static void request_stop(int) { stop_requested = 1; }
+
+// Requests are the priority, core cap, time budget (-1 for the scene's own),
+// working directory and output override on one line each, then the scene
+// size in bytes and the scene itself. The reply is the job's exit code on a
+// single line.
+static std::string encode_job(const tpm::serve::Job &job) {
+  return fmt::format("{}\n{}\n{}\n{}\n{}\n{}\n{}", job.priority, job.cores,
+                     job.budget ? static_cast<std::int64_t>(*job.budget) : -1,
+                     job.cwd, job.output, job.scene.size(), job.scene);
+}
+
+static bool decode_job(const int &fd, tpm::serve::Job &job) {
+  std::string line;
+  std::size_t size = 0;
+  if (!tpm::net::read_line(fd, line) ||
+      std::sscanf(line.c_str(), "%d", &job.priority) != 1)
+    return false;
+  if (!tpm::net::read_line(fd, line) ||
+      std::sscanf(line.c_str(), "%" SCNu32, &job.cores) != 1)
+    return false;
+  std::int64_t budget = -1;
+  if (!tpm::net::read_line(fd, line) ||
+      std::sscanf(line.c_str(), "%" SCNd64, &budget) != 1)
+    return false;
+  if (budget >= 0)
+    job.budget = static_cast<std::uint32_t>(budget);
+  if (!tpm::net::read_line(fd, job.cwd) ||
+      !tpm::net::read_line(fd, job.output))
+    return false;
+  if (!tpm::net::read_line(fd, line) ||
+      std::sscanf(line.c_str(), "%zu", &size) != 1 || size == 0 ||
+      size > max_scene_bytes)
+    return false;
+  return tpm::net::read_exact(fd, job.scene, size);
+}
+
+namespace tpm::serve {
+
+struct Pending {
+  Job job;
+  std::uint64_t id;
+  int fd;
+  std::chrono::steady_clock::time_point queued;
+};
+
+struct Cached {
+  std::filesystem::file_time_type mtime{};
+  std::uint64_t used = 0;
+  std::vector<OutputSpec> outputs;
+  std::uint32_t budget = 0;
+  std::unique_ptr<Renderer> renderer;
+  bool busy = false;
+};
+
+struct Slot {
+  explicit Slot(const cl::sycl::device &device) : queue(device) {}
+
+  cl::sycl::queue queue;
+  WritePool pool{max_outputs, 2 * max_outputs};
+};
+
+struct Server {
+  Server(const std::size_t &workers, const std::uint32_t &cores);
+
+  std::uint32_t job_cores(const Job &job) const;
+  Cached *acquire(const std::string &scene, const cl::sycl::queue &queue,
+                  ExitCode &status, Cached &scratch);
+  void release(Cached *entry);
+  void receive(const int &fd);
+  std::size_t pick(const std::chrono::steady_clock::time_point &now) const;
+  ExitCode render(const Job &job, const std::uint32_t &cores, Slot &slot);
+  void work(Slot &slot);
+
+  std::uint32_t total_cores, default_cores, free_cores;
+
+  std::mutex cache_mutex;
+  std::map<std::string, Cached> cache;
+  std::uint64_t tick = 0;
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::vector<Pending> jobs;
+  std::uint64_t next_id = 0;
+  std::size_t receiving = 0;
+};
+
+} // namespace tpm::serve
+
+tpm::serve::Server::Server(const std::size_t &workers,
+                           const std::uint32_t &cores)
+    : total_cores(std::max(1u, std::thread::hardware_concurrency())),
+      default_cores(cores != 0 ? cores
+                               : std::max<std::uint32_t>(
+                                     1, total_cores /
+                                            static_cast<std::uint32_t>(
+                                                std::max<std::size_t>(
+                                                    1, workers)))),
+      free_cores(total_cores) {}
+
+std::uint32_t tpm::serve::Server::job_cores(const Job &job) const {
+  return std::clamp(job.cores != 0 ? job.cores : default_cores, 1u,
+                    total_cores);
+}
+
+tpm::serve::Cached *tpm::serve::Server::acquire(const std::string &scene,
+                                                const cl::sycl::queue &queue,
+                                                ExitCode &status,
+                                                Cached &scratch) {
+  PFUNC(scene.size());
+  bool inline_xml = !scene.empty() && scene.front() == '<';
+  std::filesystem::file_time_type mtime{};
+  if (!inline_xml) {
+    std::error_code ec;
+    mtime = std::filesystem::last_write_time(scene, ec);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cache.find(scene);
+    if (it != cache.end() && it->second.mtime == mtime && !it->second.busy) {
+      // The entry may have been built on another slot, whose queue would
+      // put this job's kernels on that slot's lane.
+      it->second.busy = true;
+      it->second.used = ++tick;
+      it->second.renderer->queue = queue;
+      return &it->second;
+    }
+  }
+
+  auto [ret, spec] = inline_xml ? parse_spec_string(scene) : parse_spec(scene);
+  status = ret;
+  if (ret != OK)
+    return nullptr;
+  scratch = Cached{mtime, 0, spec.image.outputs, spec.renderer.budget,
+                   std::make_unique<Renderer>(spec, queue), true};
+
+  // A job running the cached copy of this scene, or a cache full of running
+  // scenes, leaves this Renderer private to the job.
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto it = cache.find(scene);
+  if (it != cache.end() && it->second.busy)
+    return &scratch;
+  if (it != cache.end())
+    cache.erase(it);
+  while (cache.size() >= cache_size) {
+    auto oldest = cache.end();
+    for (auto entry = cache.begin(); entry != cache.end(); ++entry) {
+      if (!entry->second.busy &&
+          (oldest == cache.end() || entry->second.used < oldest->second.used))
+        oldest = entry;
+    }
+    if (oldest == cache.end())
+      return &scratch;
+    cache.erase(oldest);
+  }
+  scratch.used = ++tick;
+  Cached &entry = cache[scene];
+  entry = std::move(scratch);
+  LINFO("Cached scene {} ({} of {} cache slots used)",
+        inline_xml ? std::string("<inline>") : scene, cache.size(),
+        cache_size);
+  return &entry;
+}
+
+void tpm::serve::Server::release(Cached *entry) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  entry->busy = false;
+}
+
+tpm::ExitCode tpm::serve::Server::render(const Job &job,
+                                         const std::uint32_t &cores,
+                                         Slot &slot) {
+  PFUNC(job.priority, cores, job.scene.size());
+  // Jobs share the daemon's working directory, so relative paths are
+  // resolved against the client's instead of changing into it.
+  std::filesystem::path cwd =
+      job.cwd.empty() ? std::filesystem::current_path()
+                      : std::filesystem::path(job.cwd);
+  auto resolve = [&](const std::string &path) {
+    std::filesystem::path p = path;
+    return p.is_absolute() ? path : (cwd / p).string();
+  };
+
+  std::string scene = job.scene;
+  if (scene.empty() || scene.front() != '<')
+    scene = resolve(scene);
+
+  ExitCode status = OK;
+  Cached scratch;
+  Cached *entry = acquire(scene, slot.queue, status, scratch);
+  if (entry == nullptr)
+    return status;
+
+  Renderer &renderer = *entry->renderer;
+  renderer.spec.image.outputs = entry->outputs;
+  if (!job.output.empty() && !renderer.spec.image.outputs.empty())
+    renderer.spec.image.outputs.front().path = job.output;
+  for (OutputSpec &output : renderer.spec.image.outputs)
+    output.path = resolve(output.path);
+  renderer.spec.renderer.cores = cores;
+  renderer.spec.renderer.budget = job.budget.value_or(entry->budget);
+  status = renderer.render_sequence(slot.pool);
+  ExitCode write_status = slot.pool.close();
+  if (status == OK)
+    status = write_status;
+  release(entry);
+  return status;
+}
+
+// Runs on its own thread per connection, at most max_receiving at once, so
+// a slow client only holds up its own request and not the accept loop.
+void tpm::serve::Server::receive(const int &fd) {
+  Job job;
+  bool ok = decode_job(fd, job);
+  std::unique_lock<std::mutex> lock(mutex);
+  --receiving;
+  if (ok) {
+    LINFO("Queued job {} with priority {} ({} pending)", next_id, job.priority,
+          jobs.size() + 1);
+    jobs.push_back(Pending{std::move(job), next_id++, fd,
+                           std::chrono::steady_clock::now()});
+  } else {
+    LWARN("Dropping malformed render job request");
+    ::close(fd);
+  }
+  lock.unlock();
+  ready.notify_all();
+}
+
+// Jobs gain one priority level per aging_step spent waiting, ties going to
+// the older job. The best ranked job that fits the free cores starts, so
+// small jobs fill the cores a large one can not use yet. Once the top ranked
+// job has waited reserve_after without fitting, nothing else starts until
+// enough cores are free for it. Returns jobs.size() when no job may start.
+std::size_t tpm::serve::Server::pick(
+    const std::chrono::steady_clock::time_point &now) const {
+  auto rank = [&](const Pending &pending) {
+    return static_cast<std::int64_t>(pending.job.priority) +
+           (now - pending.queued) / aging_step;
+  };
+  auto ahead = [&](const Pending &lhs, const Pending &rhs) {
+    std::int64_t lhs_rank = rank(lhs), rhs_rank = rank(rhs);
+    return lhs_rank != rhs_rank ? lhs_rank > rhs_rank : lhs.id < rhs.id;
+  };
+  std::size_t top = jobs.size(), best = jobs.size();
+  for (std::size_t i = 0; i < jobs.size(); ++i) {
+    if (top == jobs.size() || ahead(jobs[i], jobs[top]))
+      top = i;
+    if (job_cores(jobs[i].job) <= free_cores &&
+        (best == jobs.size() || ahead(jobs[i], jobs[best])))
+      best = i;
+  }
+  if (top != best && top != jobs.size() &&
+      now - jobs[top].queued >= reserve_after)
+    return jobs.size();
+  return best;
+}
+
+void tpm::serve::Server::work(Slot &slot) {
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait_for(lock, poll_interval, [&]() {
+      return stop_requested ||
+             pick(std::chrono::steady_clock::now()) != jobs.size();
+    });
+    if (stop_requested)
+      return;
+    std::size_t index = pick(std::chrono::steady_clock::now());
+    if (index == jobs.size())
+      continue;
+    Pending next = std::move(jobs[index]);
+    jobs.erase(jobs.begin() + static_cast<std::ptrdiff_t>(index));
+    std::uint32_t cores = job_cores(next.job);
+    free_cores -= cores;
+    lock.unlock();
+
+    LINFO("Starting job {} on {} of {} cores", next.id, cores, total_cores);
+    ExitCode ret = render(next.job, cores, slot);
+    LINFO("Finished job {} with exit code {}", next.id, ret);
+    if (!net::write_all(next.fd, fmt::format("{}\n", static_cast<int>(ret))))
+      LWARN("Client of job {} disconnected before it finished", next.id);
+    ::close(next.fd);
+
+    lock.lock();
+    free_cores += cores;
+    lock.unlock();
+    ready.notify_all();
+  }
+}
+
+std::string tpm::serve::default_socket() {
+  const char *dir = std::getenv("XDG_RUNTIME_DIR");
+  std::filesystem::path root =
+      dir != nullptr ? std::filesystem::path(dir)
+                     : std::filesystem::temp_directory_path();
+  return (root / "tpm.sock").string();
+}
+
+tpm::ExitCode tpm::serve::run(const std::string &socket,
+                              const std::size_t &workers,
+                              const std::uint32_t &cores,
+                              const std::string &selector) {
+  PFUNC(socket, workers, cores);
+  std::vector<device::Slice> slices = device::select(selector);
+  if (slices.empty()) {
+    LERR("No SYCL device matches \"{}\"", selector);
+    return DEVICE_ERROR;
+  }
+  int listener = net::listen(socket, listen_backlog);
+  if (listener < 0)
+    return SOCKET_ERROR;
+  std::signal(SIGINT, request_stop);
+  std::signal(SIGTERM, request_stop);
+
+  Server server(workers, cores);
+  std::vector<std::unique_ptr<Slot>> slots;
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < std::max<std::size_t>(1, workers); ++i) {
+    slots.push_back(
+        std::make_unique<Slot>(slices[i % slices.size()].device));
+    threads.emplace_back(&Server::work, &server, std::ref(*slots.back()));
+    LINFO("Worker {} renders on {}", i,
+          slots.back()
+              ->queue.get_device()
+              .get_info<cl::sycl::info::device::name>());
+  }
+  LINFO("Serving render jobs on \"{}\" with {} workers of {} cores each",
+        socket, slots.size(), server.default_cores);
+
+  while (!stop_requested) {
+    {
+      // Connections past max_receiving wait in the listen backlog instead
+      // of each holding a thread while its client is slow.
+      std::unique_lock<std::mutex> lock(server.mutex);
+      if (!server.ready.wait_for(lock, poll_interval, [&]() {
+            return server.receiving < max_receiving;
+          }))
+        continue;
+    }
+    pollfd pfd{listener, POLLIN, 0};
+    if (::poll(&pfd, 1, static_cast<int>(poll_interval.count())) <= 0)
+      continue;
+    int fd = ::accept(listener, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+    net::set_timeout(fd, read_timeout_s);
+    {
+      std::lock_guard<std::mutex> lock(server.mutex);
+      ++server.receiving;
+    }
+    std::thread(&Server::receive, &server, fd).detach();
+  }
+
+  {
+    // Requests still being read finish within the read timeout.
+    std::unique_lock<std::mutex> lock(server.mutex);
+    server.ready.wait(lock, [&]() { return server.receiving == 0; });
+  }
+  server.ready.notify_all();
+  for (std::thread &thread : threads)
+    thread.join();
+  for (const Pending &pending : server.jobs)
+    ::close(pending.fd);
+  ::close(listener);
+  if (!net::is_tcp(socket))
+    ::unlink(socket.c_str());
+  LINFO("Render daemon on \"{}\" stopped", socket);
+  return OK;
+}
+
+tpm::ExitCode tpm::serve::submit(const std::string &socket, const Job &job) {
+  PFUNC(socket, job.priority);
+  int fd = net::connect(socket);
+  if (fd < 0) {
+    LERR("Failed to connect to render daemon at \"{}\": {}", socket,
+         std::strerror(errno));
+    return SOCKET_ERROR;
+  }
+
+  std::string line;
+  int ret = SOCKET_ERROR;
+  if (!net::write_all(fd, encode_job(job)) || !net::read_line(fd, line) ||
+      std::sscanf(line.c_str(), "%d", &ret) != 1) {
+    LERR("Render daemon at \"{}\" dropped the job before it finished",
+         socket);
+    ret = SOCKET_ERROR;
+  }
+  ::close(fd);
+  return static_cast<ExitCode>(ret);
+}
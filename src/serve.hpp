@@ -0,0 +1,29 @@
+#ifndef SERVE_HPP_K4NQ7ZPE
+#define SERVE_HPP_K4NQ7ZPE
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "exit_code.hpp"
+
+namespace tpm::serve {
+
+struct Job {
+  int priority = 0;
+  std::uint32_t cores = 0;
+  std::optional<std::uint32_t> budget;
+  std::string scene, output, cwd;
+};
+
+std::string default_socket();
+// Worker slots take the selected devices in turn, one queue each.
+ExitCode run(const std::string &socket, const std::size_t &workers = 1,
+             const std::uint32_t &cores = 0,
+             const std::string &selector = "");
+ExitCode submit(const std::string &socket, const Job &job);
+
+} // namespace tpm::serve
+
+#endif /* end of include guard: SERVE_HPP_K4NQ7ZPE */
@@ -0,0 +1,59 @@
+#ifndef SPSC_HPP_C8YH3ZLA
+#define SPSC_HPP_C8YH3ZLA
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace tpm {
+
+template <typename T> struct SpscQueue {
+  SpscQueue(const std::size_t &capacity)
+      : buffer(capacity + 1), head(0), tail(0) {}
+
+  bool try_push(const T &item) {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    std::size_t next = (t + 1) % buffer.size();
+    if (next == head.load(std::memory_order_acquire))
+      return false;
+    buffer[t] = item;
+    tail.store(next, std::memory_order_release);
+    return true;
+  }
+  std::optional<T> try_pop() {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return std::nullopt;
+    T item = buffer[h];
+    head.store((h + 1) % buffer.size(), std::memory_order_release);
+    return item;
+  }
+
+  void push(const T &item) {
+    for (std::size_t spins = 0; !try_push(item); ++spins)
+      backoff(spins);
+  }
+  T pop() {
+    std::optional<T> item;
+    for (std::size_t spins = 0; !(item = try_pop()); ++spins)
+      backoff(spins);
+    return *item;
+  }
+
+  static void backoff(const std::size_t &spins) {
+    if (spins < 64)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+
+  std::vector<T> buffer;
+  std::atomic<std::size_t> head, tail;
+};
+
+} // namespace tpm
+
+#endif /* end of include guard: SPSC_HPP_C8YH3ZLA */
@@ -0,0 +1,103 @@
+#include "stream.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <CL/sycl.hpp>
+
+#include "convert.hpp"
+#include "exr.hpp"
+#include "log.hpp"
+#include "png.hpp"
+#include "prof.hpp"
+
+namespace tpm {
+
+struct PngSink : TileSink {
+  PngSink(cl::sycl::queue &queue, const OutputSpec &spec)
+      : queue(queue), srgb(spec.srgb), dither(spec.dither) {}
+  bool write(const Band &band) override {
+    std::vector<std::uint8_t> rgb = to_rgb8(queue, band.data, stream.width,
+                                            band.y0, band.y1, srgb, dither);
+    return stream.write_rows(rgb.data(), band.y1 - band.y0);
+  }
+  bool close() override { return stream.close(); }
+
+  cl::sycl::queue &queue;
+  bool srgb, dither;
+  png::Stream stream;
+};
+
+struct ExrSink : TileSink {
+  bool write(const Band &band) override {
+    return writer.write_rows(band.data, band.y0, band.y1);
+  }
+  bool close() override { return writer.close(); }
+
+  exr::Writer writer;
+};
+
+} // namespace tpm
+
+bool tpm::streamable(const std::filesystem::path &path) {
+  std::filesystem::path ext = path.extension();
+  return ext == ".png" || ext == ".exr";
+}
+
+std::unique_ptr<tpm::TileSink> tpm::open_sink(cl::sycl::queue &queue,
+                                              const OutputSpec &spec,
+                                              const cl::sycl::uint3 &size) {
+  std::filesystem::path path = spec.path;
+  PFUNC(path.string(), size);
+  std::filesystem::path ext = path.extension();
+  if (ext == ".png") {
+    std::unique_ptr<PngSink> sink = std::make_unique<PngSink>(queue, spec);
+    if (sink->stream.open(path, size[0], size[1], spec.compression))
+      return sink;
+  } else if (ext == ".exr") {
+    std::unique_ptr<ExrSink> sink = std::make_unique<ExrSink>();
+    if (sink->writer.open(path, size, spec.compression))
+      return sink;
+  }
+  LWARN("Failed to open \"{}\" for streaming", path.string());
+  return nullptr;
+}
+
+tpm::StreamWriter::StreamWriter(std::unique_ptr<TileSink> sink,
+                                const std::size_t &depth)
+    : sink(std::move(sink)), queue(depth), failed(false), written(0) {
+  thread = std::thread([this]() {
+    for (Band band = queue.pop(); band.data.data != nullptr;
+         band = queue.pop()) {
+      PSCOPE("WriteBand", band.y0, band.y1);
+      if (!failed && !this->sink->write(band)) {
+        LWARN("Failed to write image rows {}-{}", band.y0, band.y1);
+        failed = true;
+      }
+      written.fetch_add(1, std::memory_order_release);
+    }
+  });
+}
+
+tpm::StreamWriter::~StreamWriter() {
+  if (thread.joinable())
+    finish();
+}
+
+void tpm::StreamWriter::push(const Band &band) { queue.push(band); }
+
+void tpm::StreamWriter::wait(const std::size_t &count) {
+  for (std::size_t spins = 0;
+       written.load(std::memory_order_acquire) < count; ++spins)
+    SpscQueue<Band>::backoff(spins);
+}
+
+bool tpm::StreamWriter::finish() {
+  PFUNC();
+  queue.push(Band{0, 0, PixelView{nullptr, RGB32F}});
+  thread.join();
+  return sink->close() && !failed;
+}
@@ -0,0 +1,51 @@
+#ifndef STREAM_HPP_Q4VN7EJB
+#define STREAM_HPP_Q4VN7EJB
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <thread>
+
+#include <CL/sycl.hpp>
+
+#include "pixel.hpp"
+#include "scene.hpp"
+#include "spsc.hpp"
+
+namespace tpm {
+
+struct Band {
+  std::uint32_t y0, y1;
+  PixelView data;
+};
+
+struct TileSink {
+  virtual ~TileSink() = default;
+  virtual bool write(const Band &band) = 0;
+  virtual bool close() = 0;
+};
+
+bool streamable(const std::filesystem::path &path);
+std::unique_ptr<TileSink> open_sink(cl::sycl::queue &queue,
+                                    const OutputSpec &spec,
+                                    const cl::sycl::uint3 &size);
+
+struct StreamWriter {
+  StreamWriter(std::unique_ptr<TileSink> sink, const std::size_t &depth);
+  ~StreamWriter();
+
+  void push(const Band &band);
+  void wait(const std::size_t &count);
+  bool finish();
+
+  std::unique_ptr<TileSink> sink;
+  SpscQueue<Band> queue;
+  std::atomic<bool> failed;
+  std::atomic<std::size_t> written;
+  std::thread thread;
+};
+
+} // namespace tpm
+
+#endif /* end of include guard: STREAM_HPP_Q4VN7EJB */
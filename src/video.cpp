@@ -0,0 +1,194 @@
+#include "video.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+#include "log.hpp"
+#include "parallel.hpp"
+#include "prof.hpp"
+
+static inline std::uint8_t to_u8(const float &v) {
+  return static_cast<std::uint8_t>(v <= 0.0f     ? 0.0f
+                                   : v >= 255.0f ? 255.0f
+                                                 : v + 0.5f);
+}
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+// Writes to the encoder socket with MSG_NOSIGNAL, so an encoder that exits
+// early fails the write with EPIPE instead of raising SIGPIPE.
+static bool send_all(const int &fd, const std::uint8_t *data,
+                     const std::size_t &size) {
+  for (std::size_t sent = 0; sent < size;) {
+    ssize_t n = ::send(fd, data + sent, size - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    sent += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool tpm::video::is_video(const std::filesystem::path &path) {
+  std::filesystem::path ext = path.extension();
+  return ext == ".y4m" || ext == ".mp4" || ext == ".mkv" || ext == ".mov" ||
+         ext == ".webm" || ext == ".avi";
+}
+
+tpm::video::Writer::~Writer() {
+  if (encoder_fd >= 0 || file.is_open())
+    close();
+}
+
+bool tpm::video::Writer::open(const std::filesystem::path &path,
+                              const std::uint32_t &img_width,
+                              const std::uint32_t &img_height,
+                              const std::uint32_t &fps,
+                              const std::string &encoder) {
+  PFUNC(path.string(), img_width, img_height, fps);
+  if (img_width == 0 || img_height == 0 || fps == 0)
+    return false;
+  width = img_width;
+  height = img_height;
+  reserved = next = 0;
+  failed = false;
+
+  if (path.extension() == ".y4m") {
+    file.open(path, std::ios::binary);
+    if (!file)
+      return false;
+    file << fmt::format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C444 "
+                        "XCOLORRANGE=FULL\n",
+                        width, height, fps);
+    return static_cast<bool>(file);
+  }
+
+  // The encoder attribute is split on whitespace into extra ffmpeg
+  // arguments and ffmpeg is executed directly, so neither it nor the output
+  // path ever reaches a shell.
+  std::vector<std::string> args = {
+      "ffmpeg", "-loglevel", "error", "-y", "-f", "rawvideo", "-pix_fmt",
+      "rgb24", "-s", fmt::format("{}x{}", width, height), "-framerate",
+      fmt::format("{}", fps), "-i", "-"};
+  std::istringstream tokens(encoder);
+  for (std::string token; tokens >> token;)
+    args.push_back(token);
+  args.push_back(path.string());
+  std::vector<char *> argv;
+  for (std::string &arg : args)
+    argv.push_back(arg.data());
+  argv.push_back(nullptr);
+  LINFO("Piping frames to {}", fmt::join(args, " "));
+
+  // A socket pair rather than a pipe lets writes use MSG_NOSIGNAL.
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+    LWARN("Failed to create encoder socket: {}", std::strerror(errno));
+    return false;
+  }
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    if (::dup2(fds[1], STDIN_FILENO) < 0)
+      ::_exit(127);
+    ::execvp(argv[0], argv.data());
+    ::_exit(127);
+  }
+  ::close(fds[1]);
+  if (pid < 0) {
+    ::close(fds[0]);
+    LWARN("Failed to start ffmpeg for \"{}\": {}", path.string(),
+          std::strerror(errno));
+    return false;
+  }
+  ::shutdown(fds[0], SHUT_RD);
+  encoder_fd = fds[0];
+  encoder_pid = pid;
+  return true;
+}
+
+std::uint64_t tpm::video::Writer::reserve() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return reserved++;
+}
+
+bool tpm::video::Writer::write_frame(const std::uint64_t &frame,
+                                     const std::uint8_t *rgb) {
+  PFUNC(frame);
+  std::size_t pixels = static_cast<std::size_t>(width) * height;
+  std::vector<std::uint8_t> planes;
+  if (file.is_open()) {
+    planes.resize(pixels * 3);
+    host_parallel_for(height, [&](const std::size_t &y) {
+      for (std::size_t i = y * width; i < (y + 1) * width; ++i) {
+        float r = rgb[3 * i], g = rgb[3 * i + 1], b = rgb[3 * i + 2];
+        planes[i] = to_u8(0.299f * r + 0.587f * g + 0.114f * b);
+        planes[pixels + i] =
+            to_u8(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b);
+        planes[2 * pixels + i] =
+            to_u8(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b);
+      }
+    });
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  turn.wait(lock, [&]() { return next == frame; });
+  if (!failed) {
+    if (file.is_open()) {
+      file.write("FRAME\n", 6);
+      file.write(reinterpret_cast<const char *>(planes.data()),
+                 static_cast<std::streamsize>(planes.size()));
+      failed = !file;
+    } else if (encoder_fd >= 0) {
+      failed = !send_all(encoder_fd, rgb, 3 * pixels);
+    } else {
+      failed = true;
+    }
+    if (failed)
+      LWARN("Failed to write video frame {}", frame);
+  }
+  ++next;
+  lock.unlock();
+  turn.notify_all();
+  return !failed;
+}
+
+bool tpm::video::Writer::close() {
+  PFUNC();
+  std::lock_guard<std::mutex> lock(mutex);
+  bool ret = !failed;
+  if (file.is_open()) {
+    file.close();
+    ret = ret && static_cast<bool>(file);
+  }
+  if (encoder_fd >= 0) {
+    ::close(encoder_fd);
+    encoder_fd = -1;
+    int status = 0;
+    while (::waitpid(encoder_pid, &status, 0) < 0 && errno == EINTR)
+      continue;
+    encoder_pid = -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      LWARN("ffmpeg exited with status {}",
+            WIFEXITED(status) ? WEXITSTATUS(status) : status);
+      ret = false;
+    }
+  }
+  return ret;
+}
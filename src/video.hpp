@@ -0,0 +1,39 @@
+#ifndef VIDEO_HPP_H3XQ8NVM
+#define VIDEO_HPP_H3XQ8NVM
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include <sys/types.h>
+
+namespace tpm::video {
+
+bool is_video(const std::filesystem::path &path);
+
+struct Writer {
+  ~Writer();
+
+  bool open(const std::filesystem::path &path, const std::uint32_t &width,
+            const std::uint32_t &height, const std::uint32_t &fps,
+            const std::string &encoder);
+  std::uint64_t reserve();
+  bool write_frame(const std::uint64_t &frame, const std::uint8_t *rgb);
+  bool close();
+
+  std::ofstream file;
+  int encoder_fd = -1;
+  pid_t encoder_pid = -1;
+  std::uint32_t width = 0, height = 0;
+  std::uint64_t reserved = 0, next = 0;
+  bool failed = false;
+  std::mutex mutex;
+  std::condition_variable turn;
+};
+
+} // namespace tpm::video
+
+#endif /* end of include guard: VIDEO_HPP_H3XQ8NVM */